@@ -1,8 +1,30 @@
 #include "RedisKVStore.h"
+#include "RespCommand.h"
+#include "SpscQueue.h"
 #include "hiredis.h"
+#include "async.h"
+#include "net.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <list>
+#include <mutex>
 #include <stdexcept>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include "log.h"
 
@@ -15,7 +37,6 @@ using namespace YiCppLib;
 #endif
 
 #define KEY_WITH_NS(key, ns) ((ns) == "" ? (key) : (ns + ":" + key))
-#define KEYNS_CSTR(key, ns) KEY_WITH_NS(key, ns).c_str()
 
 #define CHECK_REPLY_STATUS(reply, expected) \
 { \
@@ -24,7 +45,7 @@ using namespace YiCppLib;
 		errMsg<<"Reply status error in "<<__func__<<", command returned nil, err: "<<pImpl_->err(); \
 		throw std::runtime_error(errMsg.str()); \
 	} \
-	else if((reply)->type() != (expected)) { \
+	else if(!(reply)->is(expected)) { \
 		std::stringstream errMsg; \
 		errMsg<<"Reply status error in "<<__func__<<", expecting "<<(expected)<<"; got "<<reply->type(); \
 		throw std::runtime_error(errMsg.str()); \
@@ -42,6 +63,15 @@ class RedisKVStore::RedisReply {
 		redisReply * reply_;
 		const bool standalone_;
 
+		static std::string toString(const redisReply *reply) {
+			return reply->str ? std::string(reply->str, reply->len) : std::string();
+		}
+
+		static double toScore(const redisReply *reply) noexcept {
+			if(reply->type == REDIS_REPLY_DOUBLE) return reply->dval;
+			return reply->str ? std::strtod(reply->str, nullptr) : 0;
+		}
+
 	public:
 		RedisReply() : RedisReply(nullptr, false) {}
 		RedisReply(redisReply *reply, bool standalone = true) : reply_(reply), standalone_(standalone) {}
@@ -50,114 +80,2137 @@ class RedisKVStore::RedisReply {
 			if(reply_ && standalone_) freeReplyObject(reply_);
 		}
 
-		std::string str() const noexcept { return std::move<std::string>(std::string(reply_->str));}
+		std::string str() const noexcept { return reply_->str ? std::string(reply_->str, reply_->len) : std::string();}
+		const char *data() const noexcept { return reply_->str;}
+		size_t size() const noexcept { return reply_->len;}
 		int type() const noexcept { return reply_->type;}
 		size_t elements() const noexcept { return reply_->elements;}
 		RedisReply elementAt(size_t idx) const noexcept { return std::move<RedisReply>(RedisReply(reply_->element[idx], false));}
-};
 
-struct RedisKVStore::Impl {
-	private:
-		redisContext * rCtx;
+		long long integer() const noexcept { return reply_->integer;}
+		double dval() const noexcept { return reply_->dval;}
+		bool boolean() const noexcept { return reply_->integer != 0;}
+		std::string vtype() const noexcept { return std::string(reply_->vtype);}
+		bool isAggregate() const noexcept { return REDIS_REPLY_IS_AGGREGATE(reply_->type);}
 
-	public:
+		/* RESP2 and RESP3 encode the same data differently, so an array
+		 * check also accepts set/push, and a string check verbatim text */
+		bool is(int expected) const noexcept {
+			if(reply_->type == expected) return true;
+			if(expected == REDIS_REPLY_ARRAY)
+				return reply_->type == REDIS_REPLY_SET || reply_->type == REDIS_REPLY_PUSH;
+			if(expected == REDIS_REPLY_STRING)
+				return reply_->type == REDIS_REPLY_VERB;
+			return false;
+		}
 
-		Impl(const std::string& ip, int port) : rCtx(nullptr) {
-			logger(LOGLV_DEBUG)<<"creating RedisKVStore object [ip:"<<ip<<", port:"<<port<<"]"<<std::endl;
+		/* decodes a RESP3 map, or a RESP2 flat array of field/value pairs */
+		std::unordered_map<std::string, std::string> toStringMap() const {
+			std::unordered_map<std::string, std::string> result;
+			result.reserve(reply_->elements / 2);
+			for(size_t i=0; i+1<reply_->elements; i+=2)
+				result.emplace(elementAt(i).str(), elementAt(i+1).str());
+			return result;
+		}
 
-			rCtx = redisConnect(ip.c_str(), port);
+		/* decodes a WITHSCORES reply: a RESP2 flat array of member/score
+		 * pairs, or a RESP3 array of [member, score] arrays. Scores are parsed
+		 * straight from the reply buffer */
+		std::vector<RedisKVStore::scored_member> toScoredMembers() const {
+			std::vector<RedisKVStore::scored_member> result;
+			bool nested = reply_->elements > 0 && REDIS_REPLY_IS_AGGREGATE(reply_->element[0]->type);
+			result.reserve(nested ? reply_->elements : reply_->elements / 2);
 
-			if(rCtx != NULL && rCtx->err) {
-				logger(LOGLV_ERR)<<"Connection was not established, err: "<< rCtx->err<<std::endl;
-				throw std::runtime_error("Unable to connect to database");
+			size_t step = nested ? 1 : 2;
+			for(size_t i=0; i+step<=reply_->elements; i+=step) {
+				const redisReply *pair = nested ? reply_->element[i] : reply_;
+				size_t first = nested ? 0 : i;
+				if(pair->elements < first + 2) continue;
+
+				const redisReply *member = pair->element[first];
+				result.emplace_back(std::string(member->str ? member->str : "", member->len), toScore(pair->element[first + 1]));
 			}
+			return result;
+		}
 
-			logger(LOGLV_DEBUG)<<"RedisKVStore object created"<<std::endl;
+		/* a score, sent as a double in RESP3 and as a string in RESP2 */
+		double score() const noexcept { return toScore(reply_);}
+
+		/* decodes an array of strings, keeping their order */
+		std::vector<std::string> toStringVector() const {
+			std::vector<std::string> result;
+			result.reserve(reply_->elements);
+			for(size_t i=0; i<reply_->elements; i++)
+				result.push_back(elementAt(i).str());
+			return result;
 		}
 
-		Impl(const std::string& unixPath) : rCtx(nullptr) {
-			logger(LOGLV_DEBUG)<<"creating RedisKVStore object [unix:"<<unixPath<<"]"<<std::endl;
+		/* decodes an array of stream entries, [id, [field, value, ...]] each */
+		std::vector<RedisKVStore::StreamEntry> toStreamEntries() const {
+			std::vector<RedisKVStore::StreamEntry> result;
+			result.reserve(reply_->elements);
+			for(size_t i=0; i<reply_->elements; i++) {
+				const redisReply *entry = reply_->element[i];
+				if(entry->elements < 1) continue;
 
-			rCtx = redisConnectUnix(unixPath.c_str());
+				result.emplace_back();
+				result.back().id = toString(entry->element[0]);
+				if(entry->elements < 2 || !REDIS_REPLY_IS_AGGREGATE(entry->element[1]->type)) continue;	// deleted
 
-			if(rCtx != NULL && rCtx->err) {
-				logger(LOGLV_ERR)<<"Connection was not established, err: "<< rCtx->err<<std::endl;
-				throw std::runtime_error("Unable to connect to database");
+				const redisReply *fields = entry->element[1];
+				auto& decoded = result.back().fields;
+				decoded.reserve(fields->elements / 2);
+				for(size_t j=0; j+1<fields->elements; j+=2)
+					decoded.emplace_back(toString(fields->element[j]), toString(fields->element[j+1]));
 			}
-
-			logger(LOGLV_DEBUG)<<"RedisKVStore object created"<<std::endl;
+			return result;
 		}
 
-		~Impl() {
-			logger(LOGLV_DEBUG)<<"releasing RedisKVStore object"<<std::endl;
-			if(rCtx != nullptr) redisFree(rCtx);
-			logger(LOGLV_DEBUG)<<"RedisKVStore object released"<<std::endl;
+		/* entries of the first stream in an XREAD or XREADGROUP reply, a RESP3
+		 * map or a RESP2 array of [key, entries] pairs */
+		std::vector<RedisKVStore::StreamEntry> toFirstStreamEntries() const {
+			if(reply_->type == REDIS_REPLY_MAP && reply_->elements >= 2)
+				return RedisReply(reply_->element[1], false).toStreamEntries();
+			if(reply_->type == REDIS_REPLY_ARRAY && reply_->elements >= 1 && reply_->element[0]->elements >= 2)
+				return RedisReply(reply_->element[0]->element[1], false).toStreamEntries();
+			return std::vector<RedisKVStore::StreamEntry>();
 		}
 
-		auto err() -> decltype(rCtx->err) const {
-			return rCtx->err;
+		/* decodes a RESP3 set, or any RESP2 array */
+		std::unordered_set<std::string> toStringSet() const {
+			std::unordered_set<std::string> result;
+			result.reserve(reply_->elements);
+			for(size_t i=0; i<reply_->elements; i++)
+				result.emplace(elementAt(i).str());
+			return result;
 		}
+};
 
-		template<class ... Args>
-		RedisKVStore::reply_ptr redisCommand(const std::string& cmd, const std::string& format, Args&&... args) const {
-			char *argStr;
-			asprintf(&argStr, (cmd + " " +format).c_str(), std::forward<Args>(args)...);
-			logger(LOGLV_INFO)<<"Redis-Exec: "<<argStr<<std::endl;
-			free(argStr);
+/* Reply builders that hand the elements of a top-level aggregate to a
+ * callback as the reader parses them, instead of building a redisReply
+ * tree. Objects they create are all &streamSentinel; the only real
+ * replies are RESP3 pushes, which are built with the regular functions. */
+struct StreamState {
+	redisReplyObjectFunctions *fallback;
+	const std::function<void(const std::string&)> *onElement;
+	std::exception_ptr error;	// first exception thrown by onElement
+	bool inPush = false;
+	int type = REDIS_REPLY_NIL;	// type of the top-level reply
+	std::string errstr;
+	size_t elements = 0;
+};
+
+static char streamSentinel;
+
+static void *streamCreateString(const redisReadTask *task, char *str, size_t len) {
+	auto state = static_cast<StreamState*>(task->privdata);
+	if(state->inPush) return state->fallback->createString(task, str, len);
 
-			auto reply = (redisReply*)::redisCommand(rCtx, (cmd + " " + format).c_str(), std::forward<Args>(args)...);
-			if(reply == NULL) return REPLY_UPTR(nullptr);
-			return REPLY_UPTR(reply);
+	if(task->parent == nullptr) {
+		state->type = task->type;
+		state->errstr.assign(str, len);
+	}
+	else if(task->parent->parent == nullptr) {
+		state->elements++;
+		if(!state->error) {
+			try { (*state->onElement)(std::string(str, len)); }
+			catch(...) { state->error = std::current_exception(); }
 		}
-};
+	}
+	return &streamSentinel;
+}
 
-RedisKVStore::RedisKVStore(const std::string& ip, int port) : pImpl_(new Impl(ip, port)) {
+static void *streamCreateArray(const redisReadTask *task, int elements) {
+	auto state = static_cast<StreamState*>(task->privdata);
+	if(task->parent == nullptr && task->type == REDIS_REPLY_PUSH) state->inPush = true;
+	if(state->inPush) return state->fallback->createArray(task, elements);
+
+	if(task->parent == nullptr) state->type = task->type;
+	return &streamSentinel;
 }
 
-RedisKVStore::RedisKVStore(const std::string& unixPath) : pImpl_(new Impl(unixPath)) {
+static void *streamCreateInteger(const redisReadTask *task, long long value) {
+	auto state = static_cast<StreamState*>(task->privdata);
+	if(state->inPush) return state->fallback->createInteger(task, value);
+
+	if(task->parent == nullptr) state->type = task->type;
+	return &streamSentinel;
 }
 
-RedisKVStore::~RedisKVStore() = default;
-RedisKVStore::RedisKVStore(RedisKVStore&& rhs) = default;
-RedisKVStore& RedisKVStore::operator=(RedisKVStore&& rhs) = default;
+static void *streamCreateNil(const redisReadTask *task) {
+	auto state = static_cast<StreamState*>(task->privdata);
+	if(state->inPush) return state->fallback->createNil(task);
 
-void RedisKVStore::removeKeyInNamespace(const std::string& key, const std::string& ns) const {
-	auto reply = pImpl_->redisCommand("DEL", "%s", KEYNS_CSTR(key, ns));
-	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	if(task->parent == nullptr) state->type = task->type;
+	return &streamSentinel;
 }
 
-void RedisKVStore::setStringValueForKeyInNamespace(const std::string& value, const std::string& key, const std::string& ns) const {
-	auto reply = pImpl_->redisCommand("SET", "%s %s", KEYNS_CSTR(key, ns), value.c_str());
-	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STATUS);
+static void *streamCreateDouble(const redisReadTask *task, double value, char *str, size_t len) {
+	auto state = static_cast<StreamState*>(task->privdata);
+	if(state->inPush) return state->fallback->createDouble(task, value, str, len);
+
+	if(task->parent == nullptr) state->type = task->type;
+	return &streamSentinel;
 }
 
-std::string RedisKVStore::stringValueForKeyInNamespace(const std::string& key, const std::string& ns) const {
-	auto reply = pImpl_->redisCommand("GET", "%s", KEYNS_CSTR(key, ns));
-	if(reply->type() == REDIS_REPLY_NIL)
-		return "";
+static void *streamCreateBool(const redisReadTask *task, int value) {
+	auto state = static_cast<StreamState*>(task->privdata);
+	if(state->inPush) return state->fallback->createBool(task, value);
 
-	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STRING);
-	return std::string(reply->str());
+	if(task->parent == nullptr) state->type = task->type;
+	return &streamSentinel;
 }
 
-/* ordered-set value operations */
-void RedisKVStore::addStringValueToSetInNamespace(const std::string& value, const std::string& key, const std::string& ns) const {
-	auto reply = pImpl_->redisCommand("SADD", "%s %s", KEYNS_CSTR(key, ns), value.c_str());
-	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+static void streamFreeObject(void *obj) {
+	if(obj != &streamSentinel) freeReplyObject(obj);
 }
 
-std::vector<std::string> RedisKVStore::stringSetValueForKeyInNamespace(const std::string& key, const std::string& ns) const {
-	auto reply = pImpl_->redisCommand("SMEMBERS", "%s", KEYNS_CSTR(key, ns));
+static redisReplyObjectFunctions streamFunctions = {
+	streamCreateString,
+	streamCreateArray,
+	streamCreateInteger,
+	streamCreateNil,
+	streamFreeObject,
+	streamCreateDouble,
+	streamCreateBool,
+	nullptr	// large bulk members go through the copying streamCreateString
+};
 
-	if(reply->type() == REDIS_REPLY_NIL)
-		return std::vector<std::string>();
+/* Pub/sub dispatch: a dedicated async connection is read by one I/O
+ * thread, which hands messages to worker threads through SPSC queues, so a
+ * slow handler never holds up the socket. Each subscription is served by
+ * the worker its channel or pattern hashes to, keeping its messages in
+ * order. Other threads talk to the I/O thread through a request queue and
+ * a wake-up pipe, as the async context is not thread-safe. A lost
+ * connection is made again by the I/O thread, which then subscribes to
+ * everything in channels and patterns once more. */
+class Subscriber {
+	public:
+		using Message = RedisKVStore::Message;
 
-	std::vector<std::string> result;
-	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+		struct Subscription {
+			std::string name;
+			bool pattern;
+			RedisKVStore::message_handler handler;
+			RedisKVStore::batch_handler batchHandler;	// used instead of handler when set
+		};
+		using subscription_ptr = std::shared_ptr<const Subscription>;
 
-	logger(LOGLV_INFO)<<"returned array has a size of "<<reply->elements()<<std::endl;
-	for(size_t i=0; i<reply->elements(); i++) {
-		result.push_back(std::string(reply->elementAt(i).str()));
-	}
-	return result;
+	private:
+		struct Delivery {
+			subscription_ptr subscription;
+			Message message;
+		};
+
+		struct Worker {
+			SpscQueue<Delivery> queue;
+			std::thread thread;
+			std::mutex mutex;
+			std::condition_variable wakeup;
+			std::atomic<bool> sleeping{false};
+			std::condition_variable space;		// the I/O thread waits here while the queue is full
+			std::atomic<bool> blocked{false};
+
+			explicit Worker(size_t capacity) : queue(capacity) {}
+		};
+
+		struct Request {
+			bool subscribe;
+			subscription_ptr subscription;	// only name and pattern are used to unsubscribe
+			std::promise<void> done;
+		};
+
+		const std::string address;
+		const int port;
+		const std::chrono::milliseconds reconnectInterval;
+
+		redisAsyncContext *ac = nullptr;	// owned by the I/O thread once it runs, null while disconnected
+		bool wantRead = false;
+		bool wantWrite = true;				// a write event completes the connect
+		int wakeFds[2] = {-1, -1};
+		std::string error;					// why the connection was lost, empty once connected; I/O thread only
+		std::chrono::steady_clock::time_point retryAt;	// next connect attempt while disconnected
+
+		std::mutex requestMutex;
+		std::deque<Request> requests;
+
+		/* I/O thread only; keys of pending, unsubscribing and deferred are
+		 * the name prefixed with 'c' for channels and 'p' for patterns */
+		std::unordered_map<std::string, subscription_ptr> channels, patterns;
+		std::unordered_map<std::string, std::vector<std::promise<void>>> pending;	// awaiting confirmation
+		std::unordered_map<std::string, std::deque<std::promise<void>>> unsubscribing;	// awaiting confirmation
+		std::unordered_map<std::string, std::deque<Request>> deferred;					// subscribes waiting for them
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		const size_t batchSize;
+		const std::chrono::milliseconds blockTimeout;
+		std::atomic<size_t> dropped{0};
+		std::atomic<bool> stopping{false};
+		std::thread io;
+
+		static std::string key(const Subscription& subscription) {
+			return (subscription.pattern ? "p" : "c") + subscription.name;
+		}
+
+		static std::string str(const redisReply *reply) {
+			return reply->str ? std::string(reply->str, reply->len) : std::string();
+		}
+
+		/* event hooks of the async context, they only record what to poll for */
+		static void addRead(void *privdata) { static_cast<Subscriber*>(privdata)->wantRead = true; }
+		static void delRead(void *privdata) { static_cast<Subscriber*>(privdata)->wantRead = false; }
+		static void addWrite(void *privdata) { static_cast<Subscriber*>(privdata)->wantWrite = true; }
+		static void delWrite(void *privdata) { static_cast<Subscriber*>(privdata)->wantWrite = false; }
+		static void cleanup(void *privdata) { delRead(privdata); delWrite(privdata); }
+
+		/* hiredis frees the context after either callback returns */
+		static void onConnect(const redisAsyncContext *ac, int status) {
+			auto self = static_cast<Subscriber*>(ac->data);
+			if(status == REDIS_OK) {
+				if(!self->error.empty()) logger(LOGLV_INFO)<<"Subscriber reconnected"<<std::endl;
+				self->error.clear();
+				return;
+			}
+			self->ac = nullptr;
+			self->lost(ac->errstr);
+		}
+
+		static void onDisconnect(const redisAsyncContext *ac, int status) {
+			auto self = static_cast<Subscriber*>(ac->data);
+			self->ac = nullptr;
+			if(!self->stopping.load()) self->lost(status == REDIS_OK ? "disconnected" : ac->errstr);
+		}
+
+		static void onReply(redisAsyncContext *, void *reply, void *privdata) {
+			if(reply != nullptr) static_cast<Subscriber*>(privdata)->handleReply(static_cast<redisReply*>(reply));
+		}
+
+		void wake() {
+			char c = 0;
+			if(write(wakeFds[1], &c, 1) == -1 && errno != EAGAIN)
+				logger(LOGLV_ERR)<<"Unable to wake the subscriber thread, err: "<<errno<<std::endl;
+		}
+
+		/* starts an async connect; false, with errstr set, if it failed at once */
+		bool connect(std::string& errstr) {
+			ac = port ? redisAsyncConnect(address.c_str(), port) : redisAsyncConnectUnix(address.c_str());
+			if(ac == nullptr || ac->err) {
+				errstr = ac ? ac->errstr : "out of memory";
+				if(ac != nullptr) redisAsyncFree(ac);
+				ac = nullptr;
+				return false;
+			}
+
+			ac->data = this;
+			ac->ev.data = this;
+			ac->ev.addRead = addRead;
+			ac->ev.delRead = delRead;
+			ac->ev.addWrite = addWrite;
+			ac->ev.delWrite = delWrite;
+			ac->ev.cleanup = cleanup;
+			redisAsyncSetConnectCallback(ac, onConnect);
+			redisAsyncSetDisconnectCallback(ac, onDisconnect);
+			wantRead = false;
+			wantWrite = true;
+			return true;
+		}
+
+		/* connects again and subscribes to what we had; the commands are
+		 * queued until the connect completes, like those of any request */
+		void reconnect() {
+			std::string errstr;
+			if(!connect(errstr)) {
+				logger(LOGLV_DEBUG)<<"Subscriber reconnect failed, err: "<<errstr<<std::endl;
+				retryAt = std::chrono::steady_clock::now() + reconnectInterval;
+				return;
+			}
+
+			logger(LOGLV_INFO)<<"Subscriber reconnecting, restoring "<<channels.size()<<" channels and "
+				<<patterns.size()<<" patterns"<<std::endl;
+			restore(channels, "SUBSCRIBE");
+			restore(patterns, "PSUBSCRIBE");
+		}
+
+		void restore(const std::unordered_map<std::string, subscription_ptr>& table, const char *command) {
+			if(table.empty()) return;
+
+			std::vector<const char *> argv{command};
+			std::vector<size_t> argvlen{strlen(command)};
+			for(const auto& subscription : table) {
+				argv.push_back(subscription.first.data());
+				argvlen.push_back(subscription.first.size());
+			}
+			if(redisAsyncCommandArgv(ac, onReply, this, (int)argv.size(), argv.data(), argvlen.data()) != REDIS_OK)
+				logger(LOGLV_ERR)<<"Unable to send "<<command<<" to restore subscriptions"<<std::endl;
+		}
+
+		/* the connection is gone. Confirmed subscriptions are kept for
+		 * reconnect(); a subscribe still in flight fails and is forgotten,
+		 * an unsubscribe in flight is done, as the server forgot us too */
+		void lost(const std::string& reason) {
+			/* one warning per outage, not one per attempt */
+			logger(error.empty() ? LOGLV_WARN : LOGLV_DEBUG)<<"Subscriber connection lost: "<<reason<<", reconnecting"<<std::endl;
+			error = reason;
+			retryAt = std::chrono::steady_clock::now() + reconnectInterval;
+
+			auto exception = std::make_exception_ptr(std::runtime_error("Subscriber connection lost: " + reason));
+			for(auto& promises : pending) {
+				(promises.first[0] == 'p' ? patterns : channels).erase(promises.first.substr(1));
+				for(auto& done : promises.second) done.set_exception(exception);
+			}
+			for(auto& promises : unsubscribing)
+				for(auto& done : promises.second) done.set_value();
+			for(auto& waiting : deferred)
+				for(auto& request : waiting.second) request.done.set_exception(exception);
+			pending.clear();
+			unsubscribing.clear();
+			deferred.clear();
+		}
+
+		/* drops a connection hiredis did not give up on by itself */
+		void drop(const std::string& reason) {
+			if(ac != nullptr) {
+				ac->onDisconnect = nullptr;
+				redisAsyncFree(ac);
+				ac = nullptr;
+			}
+			lost(reason);
+		}
+
+		void ioLoop() {
+			while(!stopping.load()) {
+				auto now = std::chrono::steady_clock::now();
+				if(ac == nullptr && now >= retryAt) reconnect();
+
+				struct pollfd fds[2];
+				nfds_t nfds = 1;
+				int timeout = -1;
+				fds[0] = {wakeFds[0], POLLIN, 0};
+				if(ac != nullptr) {
+					fds[1] = {ac->c.fd, (short)((wantRead ? POLLIN : 0) | (wantWrite ? POLLOUT : 0)), 0};
+					nfds = 2;
+				}
+				else timeout = std::max(0, (int)std::chrono::duration_cast<std::chrono::milliseconds>(retryAt - now).count() + 1);
+
+				if(poll(fds, nfds, timeout) == -1) {
+					if(errno == EINTR) continue;
+					drop("poll failed, err: " + std::to_string(errno));
+					continue;
+				}
+
+				if(fds[0].revents != 0) {
+					char buf[64];
+					while(read(wakeFds[0], buf, sizeof(buf)) > 0);
+					handleRequests();
+				}
+				if(nfds == 2 && ac != nullptr && (fds[1].revents & (POLLIN | POLLERR | POLLHUP)))
+					redisAsyncHandleRead(ac);
+				if(nfds == 2 && ac != nullptr && (fds[1].revents & POLLOUT))
+					redisAsyncHandleWrite(ac);
+			}
+
+			if(ac != nullptr) redisAsyncFree(ac);
+		}
+
+		void handleRequests() {
+			std::deque<Request> batch;
+			{
+				std::lock_guard<std::mutex> lock(requestMutex);
+				batch.swap(requests);
+			}
+			for(auto& request : batch) handleRequest(request);
+		}
+
+		void handleRequest(Request& request) {
+			const Subscription& subscription = *request.subscription;
+			auto& table = subscription.pattern ? patterns : channels;
+
+			/* nothing to tell the server until reconnect(), which restores the tables */
+			if(ac == nullptr) {
+				if(request.subscribe)
+					request.done.set_exception(std::make_exception_ptr(std::runtime_error("Subscriber connection lost, reconnecting: " + error)));
+				else {
+					table.erase(subscription.name);
+					request.done.set_value();
+				}
+				return;
+			}
+
+			/* the reply to an earlier unsubscribe would remove the new subscription */
+			if(request.subscribe && unsubscribing.count(key(subscription))) {
+				deferred[key(subscription)].push_back(std::move(request));
+				return;
+			}
+
+			if(!request.subscribe && table.count(subscription.name) == 0) {
+				request.done.set_value();
+				return;
+			}
+
+			const char *argv[] = {
+				request.subscribe ? (subscription.pattern ? "PSUBSCRIBE" : "SUBSCRIBE") :
+					(subscription.pattern ? "PUNSUBSCRIBE" : "UNSUBSCRIBE"),
+				subscription.name.data()
+			};
+			size_t argvlen[] = {strlen(argv[0]), subscription.name.size()};
+			if(redisAsyncCommandArgv(ac, onReply, this, 2, argv, argvlen) != REDIS_OK) {
+				request.done.set_exception(std::make_exception_ptr(std::runtime_error("Unable to send " + std::string(argv[0]))));
+				return;
+			}
+
+			if(request.subscribe) {
+				table[subscription.name] = request.subscription;
+				pending[key(subscription)].push_back(std::move(request.done));
+			}
+			else {
+				table.erase(subscription.name);
+				unsubscribing[key(subscription)].push_back(std::move(request.done));
+			}
+		}
+
+		void handleReply(const redisReply *reply) {
+			if(!REDIS_REPLY_IS_AGGREGATE(reply->type) || reply->elements < 3) return;
+
+			std::string kind = str(reply->element[0]);
+			if(kind == "message")
+				dispatch(channels, str(reply->element[1]), Message{"", str(reply->element[1]), str(reply->element[2])});
+			else if(kind == "pmessage" && reply->elements >= 4)
+				dispatch(patterns, str(reply->element[1]), Message{str(reply->element[1]), str(reply->element[2]), str(reply->element[3])});
+			else if(kind == "subscribe" || kind == "psubscribe") {
+				auto confirmed = pending.find((kind[0] == 'p' ? "p" : "c") + str(reply->element[1]));
+				if(confirmed == pending.end()) return;
+				for(auto& done : confirmed->second) done.set_value();
+				pending.erase(confirmed);
+			}
+			else if(kind == "unsubscribe" || kind == "punsubscribe") {
+				std::string name = (kind[0] == 'p' ? "p" : "c") + str(reply->element[1]);
+				auto inFlight = unsubscribing.find(name);
+				if(inFlight == unsubscribing.end()) return;
+				inFlight->second.front().set_value();
+				inFlight->second.pop_front();
+				if(!inFlight->second.empty()) return;
+				unsubscribing.erase(inFlight);
+
+				auto waiting = deferred.find(name);
+				if(waiting == deferred.end()) return;
+				std::deque<Request> resumed;
+				resumed.swap(waiting->second);
+				deferred.erase(waiting);
+				for(auto& request : resumed) handleRequest(request);
+			}
+		}
+
+		void dispatch(const std::unordered_map<std::string, subscription_ptr>& table, const std::string& name, Message&& message) {
+			auto subscription = table.find(name);
+			if(subscription == table.end()) return;	// unsubscribed meanwhile
+
+			Worker& worker = *workers[std::hash<std::string>()(name) % workers.size()];
+			Delivery delivery{subscription->second, std::move(message)};
+			if(!worker.queue.tryPush(std::move(delivery))) {
+				/* the worker is behind: wait for room, but no longer than
+				 * blockTimeout, so the socket and other workers keep going */
+				notify(worker);
+				std::unique_lock<std::mutex> lock(worker.mutex);
+				worker.blocked.store(true);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				bool pushed = worker.space.wait_for(lock, blockTimeout,
+					[&] { return worker.queue.tryPush(std::move(delivery)); });
+				worker.blocked.store(false);
+				if(!pushed) {
+					if(dropped.fetch_add(1) % 1000 == 0)
+						logger(LOGLV_WARN)<<"Handler thread for "<<name<<" is behind, dropping messages"<<std::endl;
+					return;
+				}
+			}
+			notify(worker);
+		}
+
+		static void notify(Worker& worker) {
+			/* pairs with the fence in workerLoop, so either the worker sees
+			 * the new message or we see it sleeping */
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(worker.sleeping.load(std::memory_order_relaxed)) {
+				std::lock_guard<std::mutex> lock(worker.mutex);
+				worker.wakeup.notify_one();
+			}
+		}
+
+		void workerLoop(Worker& worker) {
+			std::vector<Delivery> batch;
+			batch.reserve(batchSize);
+
+			for(;;) {
+				Delivery delivery;
+				while(batch.size() < batchSize && worker.queue.tryPop(delivery))
+					batch.push_back(std::move(delivery));
+
+				if(batch.empty()) {
+					/* the I/O thread is joined before stopping is seen here, so
+					 * an empty queue means everything was delivered */
+					if(stopping.load()) return;
+
+					std::unique_lock<std::mutex> lock(worker.mutex);
+					worker.sleeping.store(true, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if(worker.queue.empty() && !stopping.load()) worker.wakeup.wait(lock);
+					worker.sleeping.store(false, std::memory_order_relaxed);
+					continue;
+				}
+
+				/* pairs with the fence in dispatch, so either the I/O thread
+				 * sees the room we made or we see it waiting */
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if(worker.blocked.load()) {
+					std::lock_guard<std::mutex> lock(worker.mutex);
+					worker.space.notify_one();
+				}
+
+				deliver(batch);
+				batch.clear();
+			}
+		}
+
+		/* consecutive messages of a batch subscription go out in one call */
+		static void deliver(std::vector<Delivery>& batch) {
+			for(size_t i=0; i<batch.size();) {
+				const Subscription& subscription = *batch[i].subscription;
+				size_t end = i + 1;
+
+				try {
+					if(subscription.batchHandler) {
+						while(end < batch.size() && batch[end].subscription.get() == &subscription) end++;
+						std::vector<Message> messages;
+						messages.reserve(end - i);
+						for(size_t j=i; j<end; j++) messages.push_back(std::move(batch[j].message));
+						subscription.batchHandler(messages);
+					}
+					else subscription.handler(batch[i].message);
+				}
+				catch(const std::exception& e) {
+					logger(LOGLV_ERR)<<"Handler for "<<subscription.name<<" threw: "<<e.what()<<std::endl;
+				}
+				catch(...) {
+					logger(LOGLV_ERR)<<"Handler for "<<subscription.name<<" threw"<<std::endl;
+				}
+				i = end;
+			}
+		}
+
+	public:
+		Subscriber(const std::string& address, int port, const RedisKVStore::ConnectionOptions& options) :
+			address(address), port(port), reconnectInterval(options.subscriberReconnectInterval),
+			batchSize(std::max<size_t>(1, options.subscriberBatchSize)),
+			blockTimeout(options.subscriberBlockTimeout) {
+			if(pipe(wakeFds) == -1)
+				throw std::runtime_error("Unable to create subscriber wake-up pipe");
+			fcntl(wakeFds[0], F_SETFL, fcntl(wakeFds[0], F_GETFL) | O_NONBLOCK);
+			fcntl(wakeFds[1], F_SETFL, fcntl(wakeFds[1], F_GETFL) | O_NONBLOCK);
+
+			std::string errstr;
+			if(!connect(errstr)) {
+				close(wakeFds[0]);
+				close(wakeFds[1]);
+				logger(LOGLV_ERR)<<"Subscriber connection was not established, err: "<<errstr<<std::endl;
+				throw std::runtime_error("Unable to connect subscriber to database: " + errstr);
+			}
+
+			size_t threads = std::max<size_t>(1, options.subscriberThreads);
+			for(size_t i=0; i<threads; i++) {
+				workers.emplace_back(new Worker(std::max<size_t>(1, options.subscriberQueueSize)));
+				Worker& worker = *workers.back();
+				worker.thread = std::thread([this, &worker] { workerLoop(worker); });
+			}
+			io = std::thread([this] { ioLoop(); });
+		}
+
+		~Subscriber() {
+			stopping.store(true);
+			wake();
+			io.join();
+
+			for(auto& worker : workers) {
+				{
+					std::lock_guard<std::mutex> lock(worker->mutex);
+					worker->wakeup.notify_one();
+				}
+				worker->thread.join();
+			}
+			close(wakeFds[0]);
+			close(wakeFds[1]);
+		}
+
+		size_t droppedMessages() const { return dropped.load(); }
+
+		/* blocks until the server confirmed the request */
+		void request(bool subscribe, const subscription_ptr& subscription) {
+			std::promise<void> done;
+			auto future = done.get_future();
+			{
+				std::lock_guard<std::mutex> lock(requestMutex);
+				requests.push_back(Request{subscribe, subscription, std::move(done)});
+			}
+			wake();
+			future.get();
+		}
+};
+
+/* values loaded by warmNamespace(), keyed by namespaced key. Holds at most
+ * capacity keys, evicting the least recently used, and forgets a key once
+ * its ttl has passed; capacity 0 keeps nothing */
+class LocalCache {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		LocalCache(size_t capacity, std::chrono::milliseconds ttl) : capacity_(capacity), ttl_(ttl) {}
+
+		size_t capacity() const { return capacity_; }
+
+		const std::string *findString(const std::string& key) {
+			auto entry = find(key);
+			return entry == nullptr || entry->isSet ? nullptr : &entry->value;
+		}
+
+		const std::vector<std::string> *findSet(const std::string& key) {
+			auto entry = find(key);
+			return entry == nullptr || !entry->isSet ? nullptr : &entry->members;
+		}
+
+		void putString(const std::string& key, std::string value) {
+			auto entry = put(key);
+			if(entry == nullptr) return;
+			entry->isSet = false;
+			entry->value = std::move(value);
+			entry->members.clear();
+		}
+
+		void putSet(const std::string& key, std::vector<std::string> members) {
+			auto entry = put(key);
+			if(entry == nullptr) return;
+			entry->isSet = true;
+			entry->value.clear();
+			entry->members = std::move(members);
+		}
+
+		void erase(const std::string& key) {
+			auto entry = entries_.find(key);
+			if(entry == entries_.end()) return;
+			lru_.erase(entry->second.position);
+			entries_.erase(entry);
+		}
+
+		void clear() {
+			entries_.clear();
+			lru_.clear();
+		}
+
+	private:
+		struct Entry {
+			std::string value;
+			std::vector<std::string> members;
+			bool isSet;
+			clock::time_point expires;
+			std::list<std::string>::iterator position;
+		};
+
+		Entry *find(const std::string& key) {
+			auto entry = entries_.find(key);
+			if(entry == entries_.end()) return nullptr;
+			if(clock::now() >= entry->second.expires) {
+				lru_.erase(entry->second.position);
+				entries_.erase(entry);
+				return nullptr;
+			}
+			lru_.splice(lru_.begin(), lru_, entry->second.position);
+			return &entry->second;
+		}
+
+		Entry *put(const std::string& key) {
+			if(capacity_ == 0) return nullptr;
+
+			auto entry = entries_.find(key);
+			if(entry != entries_.end()) lru_.splice(lru_.begin(), lru_, entry->second.position);
+			else {
+				if(entries_.size() >= capacity_) {
+					entries_.erase(lru_.back());
+					lru_.pop_back();
+				}
+				lru_.push_front(key);
+				entry = entries_.emplace(key, Entry()).first;
+				entry->second.position = lru_.begin();
+			}
+			entry->second.expires = clock::now() + ttl_;
+			return &entry->second;
+		}
+
+		const size_t capacity_;
+		const std::chrono::milliseconds ttl_;
+		std::unordered_map<std::string, Entry> entries_;
+		std::list<std::string> lru_;		// most recently used first
+};
+
+struct RedisKVStore::Impl {
+	private:
+		redisContext * rCtx;
+
+		/* endpoint, kept for lazy and parallel connects */
+		const std::string address;
+		const int port;				// 0 for a unix socket
+		const ConnectionOptions options;
+
+	public:
+		/* pub/sub connection, created by the first subscribe */
+		std::unique_ptr<Subscriber> subscriber;
+
+		/* connection for blocking list commands, created by the first of
+		 * them so that a blocked consumer never holds up this one */
+		std::unique_ptr<Impl> blocking;
+		std::mutex blockingMutex;
+
+		/* values loaded by warmNamespace(); only consulted while the server
+		 * tracks them for us, see cacheActive() */
+		LocalCache cache;
+		bool tracking;
+		int protocol;		// RESP version asked for with HELLO, restored on reconnect
+
+		Impl(const std::string& ip, int port, const ConnectionOptions& options) :
+			rCtx(nullptr), address(ip), port(port), options(options),
+			cache(options.localCacheSize, options.localCacheTtl), tracking(false), protocol(2) {
+			logger(LOGLV_DEBUG)<<"creating RedisKVStore object [ip:"<<ip<<", port:"<<port<<"]"<<std::endl;
+			if(!options.lazyConnect) connect();
+			logger(LOGLV_DEBUG)<<"RedisKVStore object created"<<std::endl;
+		}
+
+		Impl(const std::string& unixPath, const ConnectionOptions& options) :
+			rCtx(nullptr), address(unixPath), port(0), options(options),
+			cache(options.localCacheSize, options.localCacheTtl), tracking(false), protocol(2) {
+			logger(LOGLV_DEBUG)<<"creating RedisKVStore object [unix:"<<unixPath<<"]"<<std::endl;
+			if(!options.lazyConnect) connect();
+			logger(LOGLV_DEBUG)<<"RedisKVStore object created"<<std::endl;
+		}
+
+		bool connected() const { return rCtx != nullptr; }
+
+		/* without CLIENT TRACKING nothing tells us a cached key changed */
+		bool cacheActive() const { return tracking && cache.capacity() > 0; }
+
+		/* blocking connect */
+		void connect() {
+			if(options.connectTimeout.count() > 0)
+				rCtx = port ? redisConnectWithTimeout(address.c_str(), port, toTimeval(options.connectTimeout)) :
+					redisConnectUnixWithTimeout(address.c_str(), toTimeval(options.connectTimeout));
+			else
+				rCtx = port ? redisConnect(address.c_str(), port) : redisConnectUnix(address.c_str());
+
+			checkConnected();
+			configure();
+		}
+
+		/* first half of a parallel connect: starts the handshake and returns
+		 * the socket to wait on for writability */
+		int startConnect() {
+			rCtx = port ? redisConnectNonBlock(address.c_str(), port) : redisConnectUnixNonBlock(address.c_str());
+			checkConnected();
+			return rCtx->fd;
+		}
+
+		/* second half, once the socket is writable */
+		void finishConnect() {
+			if(redisCheckSocketError(rCtx) == REDIS_OK && redisSetBlocking(rCtx, 1) == REDIS_OK)
+				rCtx->flags |= REDIS_BLOCK;
+			checkConnected();
+			configure();
+		}
+
+		/* abandon a parallel connect, e.g. on timeout */
+		void abortConnect(const std::string& reason) {
+			logger(LOGLV_ERR)<<"Connection to "<<address<<" was not established: "<<reason<<std::endl;
+			redisFree(rCtx);
+			rCtx = nullptr;
+		}
+
+		/* connect deadline for connectAll(), zero when there is none */
+		std::chrono::milliseconds connectTimeout() const { return options.connectTimeout; }
+
+		void checkConnected() {
+			if(rCtx == nullptr) {
+				logger(LOGLV_ERR)<<"Connection was not established, out of memory"<<std::endl;
+				throw std::runtime_error("Unable to connect to database");
+			}
+			if(rCtx->err) {
+				logger(LOGLV_ERR)<<"Connection was not established, err: "<< rCtx->err<<std::endl;
+				std::string errstr(rCtx->errstr);
+				redisFree(rCtx);
+				rCtx = nullptr;
+				throw std::runtime_error("Unable to connect to database: " + errstr);
+			}
+		}
+
+		Subscriber& pubsub() {
+			if(!subscriber) subscriber.reset(new Subscriber(address, port, options));
+			return *subscriber;
+		}
+
+		/* makes connections of their own for commands that must not share
+		 * this one, e.g. blocking ones; they outlive this object */
+		std::function<Impl*()> connector() const {
+			std::string address = this->address;
+			int port = this->port;
+			ConnectionOptions options = this->options;
+			options.commandTimeout = std::chrono::milliseconds(0);	// blocking commands carry their own
+			options.lazyConnect = false;
+			return [address, port, options]() {
+				return port ? new Impl(address, port, options) : new Impl(address, options);
+			};
+		}
+
+		/* callers hold blockingMutex */
+		Impl& blocker() {
+			if(!blocking) blocking.reset(connector()());
+			return *blocking;
+		}
+
+		/* the connection, established on first use for lazy stores */
+		redisContext *connection() {
+			if(rCtx == nullptr) connect();
+			else if(rCtx->err) reconnect();
+			return rCtx;
+		}
+
+		/* the connection broke: redisReconnect() reuses the addresses the
+		 * host resolved to and reapplies the socket options, then the
+		 * protocol is restored */
+		void reconnect() {
+			logger(LOGLV_WARN)<<"reconnecting to "<<address<<" after err: "<<rCtx->errstr<<std::endl;
+			cache.clear();
+			tracking = false;
+			if(redisReconnect(rCtx) != REDIS_OK || rCtx->err) checkConnected();
+			if(protocol != 2) hello(protocol);
+		}
+
+		/* switch protocol, with CLIENT TRACKING on RESP3; keys cached before
+		 * tracking started may already be stale, so the cache is emptied */
+		void hello(int version) {
+			auto reply = redisCommandArgv({"HELLO", std::to_string(version)});
+			if(reply.get() != nullptr && reply->type() == REDIS_REPLY_ERROR)
+				throw std::runtime_error("Unable to switch protocol: " + reply->str());
+			if(reply.get() == nullptr || !(reply->is(REDIS_REPLY_MAP) || reply->is(REDIS_REPLY_ARRAY))) {	// RESP2 answers HELLO with a flat array
+				std::stringstream errMsg;
+				errMsg<<"Unable to switch protocol, err: "<<err();
+				throw std::runtime_error(errMsg.str());
+			}
+
+			cache.clear();
+			tracking = false;
+			protocol = version;
+			if(version >= 3) {
+				reply = redisCommandArgv({"CLIENT", "TRACKING", "ON"});
+				if(reply.get() == nullptr || !reply->is(REDIS_REPLY_STATUS)) {
+					std::stringstream errMsg;
+					errMsg<<"Unable to turn on client tracking, err: "<<err();
+					throw std::runtime_error(errMsg.str());
+				}
+				tracking = true;
+			}
+		}
+
+		static struct timeval toTimeval(std::chrono::milliseconds ms) {
+			struct timeval tv;
+			tv.tv_sec = ms.count() / 1000;
+			tv.tv_usec = (ms.count() % 1000) * 1000;
+			return tv;
+		}
+
+		/* apply socket options to the freshly connected context */
+		void configure() {
+			bool tcp = port != 0;
+			int status = redisContextSetSocketBuffers(rCtx, options.recvBufferSize, options.sendBufferSize);
+
+			if(status == REDIS_OK && tcp && !options.noDelay)
+				status = redisContextSetTcpNoDelay(rCtx, 0);
+			if(status == REDIS_OK && tcp && options.quickAck)
+				status = redisContextSetQuickAck(rCtx, 1);
+			if(status == REDIS_OK && tcp && options.keepAliveInterval > 0)
+				status = redisKeepAlive(rCtx, options.keepAliveInterval);
+			if(status == REDIS_OK && options.busyPoll > 0)
+				status = redisContextSetBusyPoll(rCtx, options.busyPoll);
+			if(status == REDIS_OK && options.spinWait > 0)
+				status = redisSetSpinWait(rCtx, options.spinWait);
+			if(status == REDIS_OK && options.commandTimeout.count() > 0)
+				status = redisSetTimeout(rCtx, toTimeval(options.commandTimeout));
+
+			if(status != REDIS_OK) {
+				logger(LOGLV_ERR)<<"Unable to apply connection options, err: "<<rCtx->errstr<<std::endl;
+				std::string errstr(rCtx->errstr);
+				redisFree(rCtx);
+				rCtx = nullptr;
+				throw std::runtime_error("Unable to apply connection options: " + errstr);
+			}
+		}
+
+		~Impl() {
+			logger(LOGLV_DEBUG)<<"releasing RedisKVStore object"<<std::endl;
+			if(rCtx != nullptr) redisFree(rCtx);
+			logger(LOGLV_DEBUG)<<"RedisKVStore object released"<<std::endl;
+		}
+
+		auto err() const -> decltype(rCtx->err) {
+			return rCtx ? rCtx->err : REDIS_ERR_IO;
+		}
+
+		/* queue a binary-safe command without waiting for its reply */
+		void appendCommandArgv(const std::vector<std::string>& args) {
+			std::vector<const char *> argv;
+			std::vector<size_t> argvlen;
+			argv.reserve(args.size());
+			argvlen.reserve(args.size());
+			for(const auto& arg : args) {
+				argv.push_back(arg.data());
+				argvlen.push_back(arg.size());
+			}
+
+			if(redisAppendCommandArgv(connection(), (int)args.size(), argv.data(), argvlen.data()) != REDIS_OK)
+				throw std::runtime_error("Unable to queue command: " + std::string(rCtx->errstr));
+		}
+
+		/* send queued commands without waiting for their replies */
+		void flush() {
+			int done = 0;
+			do {
+				if(redisBufferWrite(connection(), &done) != REDIS_OK)
+					throw std::runtime_error("Unable to send commands: " + std::string(rCtx->errstr));
+			} while(!done);
+		}
+
+		/* block for the reply of the oldest queued command, nullptr on error.
+		 * RESP3 out-of-band pushes arriving in between are consumed here */
+		RedisKVStore::reply_ptr getReply() {
+			for(;;) {
+				void *reply = nullptr;
+				if(redisGetReply(rCtx, &reply) != REDIS_OK || reply == nullptr)
+					return RedisKVStore::reply_ptr();
+
+				auto wrapped = REPLY_UPTR((redisReply*)reply);
+				if(wrapped->type() != REDIS_REPLY_PUSH) return wrapped;
+				handlePush(*wrapped);
+			}
+		}
+
+		/* consume invalidation pushes that already arrived, without blocking;
+		 * run before every cache hit, as with no command in flight nothing
+		 * else reads them */
+		void drainPushes() {
+			for(;;) {
+				void *reply = nullptr;
+				if(redisReaderGetReply(rCtx->reader, &reply) != REDIS_OK) return;
+				if(reply == nullptr) {
+					struct pollfd pfd = {rCtx->fd, POLLIN, 0};
+					if(poll(&pfd, 1, 0) <= 0 || redisBufferRead(rCtx) != REDIS_OK) return;
+					continue;
+				}
+				handlePush(RedisReply((redisReply*)reply));
+			}
+		}
+
+		/* cached value of key, nullptr when it has to be read from the server */
+		const std::string *cachedString(const std::string& key) {
+			if(!cacheActive()) return nullptr;
+			drainPushes();
+			if(rCtx->err) {
+				/* invalidations may have been lost with the connection */
+				cache.clear();
+				return nullptr;
+			}
+			return cache.findString(key);
+		}
+
+		const std::vector<std::string> *cachedSet(const std::string& key) {
+			if(!cacheActive()) return nullptr;
+			drainPushes();
+			if(rCtx->err) {
+				cache.clear();
+				return nullptr;
+			}
+			return cache.findSet(key);
+		}
+
+		/* client-side caching: drop keys the server reports as invalidated */
+		void handlePush(const RedisReply& push) {
+			if(push.elements() < 2 || push.elementAt(0).str() != "invalidate") {
+				logger(LOGLV_DEBUG)<<"ignoring push message with "<<push.elements()<<" elements"<<std::endl;
+				return;
+			}
+
+			auto keys = push.elementAt(1);
+			if(keys.type() == REDIS_REPLY_NIL) {
+				/* flush of the whole keyspace */
+				cache.clear();
+				return;
+			}
+			for(size_t i=0; i<keys.elements(); i++)
+				cache.erase(keys.elementAt(i).str());
+		}
+
+		/* binary-safe blocking command, nullptr on error */
+		RedisKVStore::reply_ptr redisCommandArgv(const std::vector<std::string>& args) {
+			appendCommandArgv(args);
+			return getReply();
+		}
+
+		/* fixed-arity command encoded from its compile-time prefix, see RespCommand.h */
+		template<class Command, class ... Args>
+		RedisKVStore::reply_ptr command(const Args&... args) {
+			char *out = redisAppendReserve(connection(), Resp::maxEncodedSize<Command>(args...));
+			if(out == nullptr)
+				throw std::runtime_error("Unable to queue command: " + std::string(rCtx->errstr));
+			redisAppendCommit(rCtx, Resp::encode<Command>(out, args...));
+			return getReply();
+		}
+
+		/* like redisCommandArgv, but large arguments are written to the socket
+		 * straight from the caller's strings, without any copy */
+		template<class ... Args>
+		RedisKVStore::reply_ptr redisCommandArgvRef(const Args&... args) {
+			const char *argv[] = {args.data()...};
+			size_t argvlen[] = {args.size()...};
+
+			if(redisAppendCommandArgvRef(connection(), (int)sizeof...(args), argv, argvlen) != REDIS_OK)
+				throw std::runtime_error("Unable to queue command: " + std::string(rCtx->errstr));
+			return getReply();
+		}
+
+		/* run a command and pass each element of its aggregate reply to
+		 * onElement without materializing the reply; returns the reply type,
+		 * element count and error message in state */
+		void streamCommandArgv(const std::vector<std::string>& args, StreamState& state,
+				const std::function<void(const std::string&)>& onElement) {
+			auto reader = connection()->reader;
+			state.fallback = reader->fn;
+			state.onElement = &onElement;
+
+			struct Restore {
+				redisReader *reader;
+				redisReplyObjectFunctions *fn;
+				void *privdata;
+				~Restore() { reader->fn = fn; reader->privdata = privdata; }
+			} restore{reader, reader->fn, reader->privdata};
+
+			appendCommandArgv(args);
+			reader->fn = &streamFunctions;
+			reader->privdata = &state;
+
+			for(;;) {
+				void *reply = nullptr;
+				if(redisGetReply(rCtx, &reply) != REDIS_OK || reply == nullptr) {
+					std::stringstream errMsg;
+					errMsg<<"Streaming "<<args[0]<<" failed, err: "<<err();
+					throw std::runtime_error(errMsg.str());
+				}
+				if(!state.inPush) break;
+
+				state.inPush = false;
+				handlePush(RedisReply((redisReply*)reply));
+			}
+
+			if(state.error) std::rethrow_exception(state.error);
+		}
+
+		/* pipeline "cmd key values..." in commands of up to batchSize values;
+		 * the first error reply is thrown once all replies are read */
+		void pipelineBatches(const std::string& cmd, const std::string& key, const std::vector<std::string>& values,
+				size_t batchSize, const std::function<void(const RedisReply&)>& onReply) {
+			size_t batches = (values.size() + batchSize - 1) / batchSize;
+			std::string error;
+			pipeline(batches, batches,
+				[&](size_t b) {
+					std::vector<std::string> args{cmd, key};
+					auto first = values.begin() + b * batchSize;
+					auto last = values.size() - b * batchSize > batchSize ? first + batchSize : values.end();
+					args.insert(args.end(), first, last);
+					return args;
+				},
+				[&](size_t, const RedisReply& reply) {
+					if(reply.type() == REDIS_REPLY_ERROR) {
+						if(error.empty()) error = reply.str();
+					}
+					else onReply(reply);
+				});
+			if(!error.empty()) throw std::runtime_error(cmd + " failed: " + error);
+		}
+
+		/* pipeline n commands, keeping at most maxInFlight of them unanswered */
+		void pipeline(size_t n, size_t maxInFlight,
+				const std::function<std::vector<std::string>(size_t)>& command,
+				const std::function<void(size_t, const RedisReply&)>& onReply) {
+			if(maxInFlight == 0) maxInFlight = 1;
+
+			size_t sent = 0, received = 0;
+			while(received < n) {
+				while(sent < n && sent - received < maxInFlight)
+					appendCommandArgv(command(sent++));
+
+				auto reply = getReply();
+				if(reply.get() == nullptr) {
+					std::stringstream errMsg;
+					errMsg<<"Pipelined command "<<received<<" of "<<n<<" failed, err: "<<err();
+					throw std::runtime_error(errMsg.str());
+				}
+				onReply(received++, *reply);
+			}
+		}
+};
+
+RedisKVStore::RedisKVStore(const std::string& ip, int port) : RedisKVStore(ip, port, ConnectionOptions()) {
+}
+
+RedisKVStore::RedisKVStore(const std::string& ip, int port, const ConnectionOptions& options) : pImpl_(new Impl(ip, port, options)) {
+}
+
+RedisKVStore::RedisKVStore(const std::string& unixPath) : RedisKVStore(unixPath, ConnectionOptions()) {
+}
+
+RedisKVStore::RedisKVStore(const std::string& unixPath, const ConnectionOptions& options) : pImpl_(new Impl(unixPath, options)) {
+}
+
+size_t RedisKVStore::connectAll(const std::vector<pointer>& stores) {
+	using clock = std::chrono::steady_clock;
+
+	struct Pending {
+		Impl *impl;
+		clock::time_point deadline;
+	};
+	std::vector<Pending> pending;
+	std::vector<struct pollfd> fds;
+	size_t failed = 0;
+
+	auto start = clock::now();
+	for(const auto& store : stores) {
+		Impl *impl = store->pImpl_.get();
+		if(impl->connected()) continue;
+
+		try { fds.push_back({impl->startConnect(), POLLOUT, 0}); }
+		catch(const std::runtime_error&) { failed++; continue; }
+		pending.push_back({impl, impl->connectTimeout().count() > 0 ? start + impl->connectTimeout() : clock::time_point::max()});
+	}
+
+	logger(LOGLV_DEBUG)<<"connecting "<<pending.size()<<" stores in parallel"<<std::endl;
+
+	while(!pending.empty()) {
+		auto now = clock::now();
+		auto deadline = std::min_element(pending.begin(), pending.end(),
+				[](const Pending& a, const Pending& b) { return a.deadline < b.deadline; })->deadline;
+		int wait = -1;
+		if(deadline != clock::time_point::max())
+			wait = (int)std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count());
+
+		if(poll(fds.data(), fds.size(), wait) == -1) {
+			if(errno == EINTR) continue;
+			for(auto& store : pending) store.impl->abortConnect("poll failed");
+			failed += pending.size();
+			break;
+		}
+
+		now = clock::now();
+		for(size_t i=0; i<pending.size();) {
+			bool done = true;
+			if(fds[i].revents != 0) {
+				try { pending[i].impl->finishConnect(); }
+				catch(const std::runtime_error&) { failed++; }
+			}
+			else if(now >= pending[i].deadline) {
+				pending[i].impl->abortConnect("connect timed out");
+				failed++;
+			}
+			else done = false;
+
+			if(done) {
+				pending[i] = pending.back();
+				pending.pop_back();
+				fds[i] = fds.back();
+				fds.pop_back();
+			}
+			else i++;
+		}
+	}
+
+	if(failed > 0)
+		logger(LOGLV_WARN)<<"unable to connect "<<failed<<" of "<<stores.size()<<" stores, they retry on first use"<<std::endl;
+	return failed;
+}
+
+RedisKVStore::~RedisKVStore() = default;
+RedisKVStore::RedisKVStore(RedisKVStore&& rhs) = default;
+RedisKVStore& RedisKVStore::operator=(RedisKVStore&& rhs) = default;
+
+void RedisKVStore::setProtocolVersion(int version) const {
+	/* invalidation pushes need RESP3, they keep the warmNamespace() cache coherent */
+	pImpl_->hello(version);
+}
+
+void RedisKVStore::removeKeyInNamespace(const std::string& key, const std::string& ns) const {
+	pImpl_->cache.erase(KEY_WITH_NS(key, ns));
+
+	auto reply = pImpl_->command<Resp::DEL>(KEY_WITH_NS(key, ns));
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+}
+
+void RedisKVStore::setStringValueForKeyInNamespace(const std::string& value, const std::string& key, const std::string& ns) const {
+	pImpl_->cache.erase(KEY_WITH_NS(key, ns));
+
+	/* large values are sent from value itself rather than copied */
+	auto reply = value.size() < REDIS_WRITE_REF_MIN ?
+		pImpl_->command<Resp::SET>(KEY_WITH_NS(key, ns), value) :
+		pImpl_->redisCommandArgvRef(std::string("SET"), KEY_WITH_NS(key, ns), value);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STATUS);
+}
+
+std::string RedisKVStore::stringValueForKeyInNamespace(const std::string& key, const std::string& ns) const {
+	auto cached = pImpl_->cachedString(KEY_WITH_NS(key, ns));
+	if(cached != nullptr) return *cached;
+
+	auto reply = pImpl_->command<Resp::GET>(KEY_WITH_NS(key, ns));
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_NIL)
+		return "";
+
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STRING);
+	return std::string(reply->str());
+}
+
+bool RedisKVStore::visitValueForKeyInNamespace(const std::string& key, const std::string& ns,
+		void (*visit)(const char *data, size_t size, void *context), void *context) const {
+	auto cached = pImpl_->cachedString(KEY_WITH_NS(key, ns));
+	if(cached != nullptr) {
+		visit(cached->data(), cached->size(), context);
+		return true;
+	}
+
+	auto reply = pImpl_->command<Resp::GET>(KEY_WITH_NS(key, ns));
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_NIL)
+		return false;
+
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STRING);
+	visit(reply->data(), reply->size(), context);
+	return true;
+}
+
+/* set value operations */
+void RedisKVStore::addStringValueToSetInNamespace(const std::string& value, const std::string& key, const std::string& ns) const {
+	pImpl_->cache.erase(KEY_WITH_NS(key, ns));
+
+	auto reply = pImpl_->command<Resp::SADD>(KEY_WITH_NS(key, ns), value);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+}
+
+std::vector<std::string> RedisKVStore::stringSetValueForKeyInNamespace(const std::string& key, const std::string& ns) const {
+	auto cached = pImpl_->cachedSet(KEY_WITH_NS(key, ns));
+	if(cached != nullptr) return *cached;
+
+	auto reply = pImpl_->command<Resp::SMEMBERS>(KEY_WITH_NS(key, ns));
+
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_NIL)
+		return std::vector<std::string>();
+
+	std::vector<std::string> result;
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+
+	logger(LOGLV_INFO)<<"returned array has a size of "<<reply->elements()<<std::endl;
+	for(size_t i=0; i<reply->elements(); i++) {
+		result.push_back(std::string(reply->elementAt(i).str()));
+	}
+	return result;
+}
+
+size_t RedisKVStore::forEachStringInSetInNamespace(const std::function<void(const std::string&)>& callback, const std::string& key, const std::string& ns) const {
+	auto cached = pImpl_->cachedSet(KEY_WITH_NS(key, ns));
+	if(cached != nullptr) {
+		/* copied, callback may modify the key and so evict it */
+		auto members = *cached;
+		for(const auto& member : members) callback(member);
+		return members.size();
+	}
+
+	StreamState state;
+	pImpl_->streamCommandArgv({"SMEMBERS", KEY_WITH_NS(key, ns)}, state, callback);
+
+	if(state.type == REDIS_REPLY_NIL)
+		return 0;
+
+	if(state.type != REDIS_REPLY_ARRAY && state.type != REDIS_REPLY_SET) {
+		std::stringstream errMsg;
+		errMsg<<"Reply status error in "<<__func__<<", expecting "<<REDIS_REPLY_ARRAY<<"; got "<<state.type;
+		if(state.type == REDIS_REPLY_ERROR) errMsg<<" ("<<state.errstr<<")";
+		throw std::runtime_error(errMsg.str());
+	}
+
+	logger(LOGLV_INFO)<<"streamed "<<state.elements<<" set members"<<std::endl;
+	return state.elements;
+}
+
+/* sorted-set value operations */
+
+/* a score argument; %.17g round-trips every double, and Redis reads the
+ * "inf" and "-inf" it prints for infinities */
+static std::string scoreArg(double score) {
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%.17g", score);
+	return std::string(buf, len);
+}
+
+void RedisKVStore::addStringValueToSortedSetInNamespace(double score, const std::string& value, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->command<Resp::ZADD>(KEY_WITH_NS(key, ns), scoreArg(score), value);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+}
+
+size_t RedisKVStore::addStringValuesToSortedSetInNamespace(const std::vector<scored_member>& values, const std::string& key, const std::string& ns) const {
+	if(values.empty()) return 0;
+
+	std::vector<std::string> args;
+	args.reserve(2 + values.size() * 2);
+	args.push_back("ZADD");
+	args.push_back(KEY_WITH_NS(key, ns));
+	for(const auto& value : values) {
+		args.push_back(scoreArg(value.second));
+		args.push_back(value.first);
+	}
+
+	auto reply = pImpl_->redisCommandArgv(args);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+double RedisKVStore::incrementScoreOfStringInSortedSetInNamespace(double increment, const std::string& value, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->command<Resp::ZINCRBY>(KEY_WITH_NS(key, ns), scoreArg(increment), value);
+	if(reply.get() == nullptr || reply->type() != REDIS_REPLY_DOUBLE)
+		CHECK_REPLY_STATUS(reply, REDIS_REPLY_STRING);	// RESP2 sends the score as a string
+	return reply->score();
+}
+
+std::vector<RedisKVStore::scored_member> RedisKVStore::sortedSetRangeForKeyInNamespace(long long start, long long stop, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->redisCommandArgv({"ZRANGE", KEY_WITH_NS(key, ns), std::to_string(start), std::to_string(stop), "WITHSCORES"});
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+	return reply->toScoredMembers();
+}
+
+std::vector<RedisKVStore::scored_member> RedisKVStore::reverseSortedSetRangeForKeyInNamespace(long long start, long long stop, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->redisCommandArgv({"ZREVRANGE", KEY_WITH_NS(key, ns), std::to_string(start), std::to_string(stop), "WITHSCORES"});
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+	return reply->toScoredMembers();
+}
+
+std::vector<RedisKVStore::scored_member> RedisKVStore::sortedSetRangeByScoreForKeyInNamespace(double min, double max, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->redisCommandArgv({"ZRANGEBYSCORE", KEY_WITH_NS(key, ns), scoreArg(min), scoreArg(max), "WITHSCORES"});
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+	return reply->toScoredMembers();
+}
+
+std::vector<RedisKVStore::scored_member> RedisKVStore::sortedSetRangeByScoreForKeyInNamespace(double min, double max, size_t offset, size_t count, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->redisCommandArgv({"ZRANGEBYSCORE", KEY_WITH_NS(key, ns), scoreArg(min), scoreArg(max), "WITHSCORES",
+			"LIMIT", std::to_string(offset), std::to_string(count)});
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+	return reply->toScoredMembers();
+}
+
+long long RedisKVStore::rankOfStringInSortedSetInNamespace(const std::string& value, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->command<Resp::ZRANK>(KEY_WITH_NS(key, ns), value);
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_NIL)
+		return -1;
+
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+size_t RedisKVStore::removeStringFromSortedSetInNamespace(const std::string& value, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->command<Resp::ZREM>(KEY_WITH_NS(key, ns), value);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+size_t RedisKVStore::removeStringsFromSortedSetInNamespace(const std::vector<std::string>& values, const std::string& key, const std::string& ns) const {
+	if(values.empty()) return 0;
+
+	std::vector<std::string> args;
+	args.reserve(2 + values.size());
+	args.push_back("ZREM");
+	args.push_back(KEY_WITH_NS(key, ns));
+	args.insert(args.end(), values.begin(), values.end());
+
+	auto reply = pImpl_->redisCommandArgv(args);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+/* list value operations */
+constexpr size_t RedisKVStore::listBatchSize;
+
+size_t RedisKVStore::pushStringValuesToListInNamespace(const std::vector<std::string>& values, const std::string& key, const std::string& ns) const {
+	size_t length = 0;
+	pImpl_->pipelineBatches("RPUSH", KEY_WITH_NS(key, ns), values, listBatchSize,
+		[&](const RedisReply& reply) { length = reply.integer(); });
+	return length;
+}
+
+size_t RedisKVStore::pushStringValuesToFrontOfListInNamespace(const std::vector<std::string>& values, const std::string& key, const std::string& ns) const {
+	size_t length = 0;
+	pImpl_->pipelineBatches("LPUSH", KEY_WITH_NS(key, ns), values, listBatchSize,
+		[&](const RedisReply& reply) { length = reply.integer(); });
+	return length;
+}
+
+std::vector<std::string> RedisKVStore::popStringValuesFromListInNamespace(size_t count, const std::string& key, const std::string& ns) const {
+	if(count == 0) return std::vector<std::string>();
+
+	auto reply = pImpl_->redisCommandArgv({"LPOP", KEY_WITH_NS(key, ns), std::to_string(count)});
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_NIL)
+		return std::vector<std::string>();
+
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+	return reply->toStringVector();
+}
+
+std::vector<std::string> RedisKVStore::popStringValuesFromBackOfListInNamespace(size_t count, const std::string& key, const std::string& ns) const {
+	if(count == 0) return std::vector<std::string>();
+
+	auto reply = pImpl_->redisCommandArgv({"RPOP", KEY_WITH_NS(key, ns), std::to_string(count)});
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_NIL)
+		return std::vector<std::string>();
+
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+	return reply->toStringVector();
+}
+
+bool RedisKVStore::reserveStringValueFromListInNamespace(std::string& value, const std::string& processingKey, std::chrono::milliseconds timeout, const std::string& key, const std::string& ns) const {
+	char seconds[32];
+	snprintf(seconds, sizeof(seconds), "%.3f", timeout.count() / 1000.0);
+
+	std::lock_guard<std::mutex> lock(pImpl_->blockingMutex);
+	auto& blocker = pImpl_->blocker();
+	auto reply = blocker.redisCommandArgv({"BLMOVE", KEY_WITH_NS(key, ns), KEY_WITH_NS(processingKey, ns), "LEFT", "RIGHT", seconds});
+
+	if(reply.get() == nullptr) {
+		std::stringstream errMsg;
+		errMsg<<"Reply status error in "<<__func__<<", command returned nil, err: "<<blocker.err();
+		pImpl_->blocking.reset();	// reconnect on the next call
+		throw std::runtime_error(errMsg.str());
+	}
+	if(reply->type() == REDIS_REPLY_NIL)
+		return false;
+
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STRING);
+	value = reply->str();
+	return true;
+}
+
+std::vector<std::string> RedisKVStore::reserveStringValuesFromListInNamespace(size_t count, const std::string& processingKey, const std::string& key, const std::string& ns) const {
+	std::vector<std::string> result;
+	std::vector<std::string> move{"LMOVE", KEY_WITH_NS(key, ns), KEY_WITH_NS(processingKey, ns), "LEFT", "RIGHT"};
+
+	/* every LMOVE past the end of the list answers nil, but one that raced
+	 * with a producer may still move a value, so all replies are kept */
+	std::string error;
+	pImpl_->pipeline(count, listBatchSize,
+		[&](size_t) { return move; },
+		[&](size_t, const RedisReply& reply) {
+			if(reply.is(REDIS_REPLY_STRING)) result.push_back(reply.str());
+			else if(reply.is(REDIS_REPLY_ERROR) && error.empty()) error = reply.str();
+		});
+	if(!error.empty()) throw std::runtime_error("LMOVE failed: " + error);
+	return result;
+}
+
+size_t RedisKVStore::acknowledgeStringValuesInListInNamespace(const std::vector<std::string>& values, const std::string& processingKey, const std::string& ns) const {
+	size_t removed = 0;
+	std::string processing = KEY_WITH_NS(processingKey, ns);
+
+	/* every reply is read before the first error is thrown, so none is
+	 * left behind on the connection */
+	std::string error;
+	pImpl_->pipeline(values.size(), listBatchSize,
+		[&](size_t i) { return std::vector<std::string>{"LREM", processing, "1", values[i]}; },
+		[&](size_t, const RedisReply& reply) {
+			if(reply.is(REDIS_REPLY_INTEGER)) removed += reply.integer();
+			else if(error.empty()) error = reply.is(REDIS_REPLY_ERROR) ? reply.str() : "unexpected reply";
+		});
+	if(!error.empty()) throw std::runtime_error("LREM failed: " + error);
+	return removed;
+}
+
+size_t RedisKVStore::requeueStringValuesFromListInNamespace(const std::string& processingKey, const std::string& key, const std::string& ns) const {
+	size_t moved = 0;
+	bool drained = false;
+	std::string error;
+
+	/* newest first onto the front of key, which keeps the original order;
+	 * no more LMOVEs are sent than processingKey holds, and the first nil
+	 * means another client emptied it meanwhile */
+	std::vector<std::string> move{"LMOVE", KEY_WITH_NS(processingKey, ns), KEY_WITH_NS(key, ns), "RIGHT", "LEFT"};
+	while(!drained) {
+		auto length = pImpl_->redisCommandArgv({"LLEN", KEY_WITH_NS(processingKey, ns)});
+		CHECK_REPLY_STATUS(length, REDIS_REPLY_INTEGER);
+		if(length->integer() <= 0) break;
+
+		size_t count = std::min<size_t>(length->integer(), listBatchSize);
+		pImpl_->pipeline(count, count,
+			[&](size_t) { return move; },
+			[&](size_t, const RedisReply& reply) {
+				if(reply.is(REDIS_REPLY_STRING)) moved++;
+				else {
+					if(!reply.is(REDIS_REPLY_NIL) && error.empty())
+						error = reply.is(REDIS_REPLY_ERROR) ? reply.str() : "unexpected reply";
+					drained = true;
+				}
+			});
+	}
+	if(!error.empty()) throw std::runtime_error("LMOVE failed: " + error);
+	return moved;
+}
+
+/* stream operations */
+static std::vector<std::string> xaddArgs(const RedisKVStore::stream_fields& fields, const std::string& key, size_t maxLength) {
+	std::vector<std::string> args{"XADD", key};
+	args.reserve(5 + fields.size() * 2);
+	if(maxLength > 0) {
+		args.push_back("MAXLEN");
+		args.push_back("~");
+		args.push_back(std::to_string(maxLength));
+	}
+	args.push_back("*");
+	for(const auto& field : fields) {
+		args.push_back(field.first);
+		args.push_back(field.second);
+	}
+	return args;
+}
+
+static std::vector<std::string> xreadgroupArgs(const std::string& group, const std::string& consumer, size_t count, std::chrono::milliseconds block, const std::string& key) {
+	std::vector<std::string> args{"XREADGROUP", "GROUP", group, consumer, "COUNT", std::to_string(count)};
+	if(block.count() > 0) {
+		args.push_back("BLOCK");
+		args.push_back(std::to_string(block.count()));
+	}
+	args.push_back("STREAMS");
+	args.push_back(key);
+	args.push_back(">");
+	return args;
+}
+
+std::string RedisKVStore::addEntryToStreamInNamespace(const stream_fields& fields, const std::string& key, const std::string& ns, size_t maxLength) const {
+	auto reply = pImpl_->redisCommandArgv(xaddArgs(fields, KEY_WITH_NS(key, ns), maxLength));
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STRING);
+	return reply->str();
+}
+
+std::vector<std::string> RedisKVStore::addEntriesToStreamInNamespace(const std::vector<stream_fields>& entries, const std::string& key, const std::string& ns, size_t maxLength) const {
+	std::vector<std::string> ids;
+	ids.reserve(entries.size());
+	std::string error;
+
+	pImpl_->pipeline(entries.size(), listBatchSize,
+		[&](size_t i) { return xaddArgs(entries[i], KEY_WITH_NS(key, ns), maxLength); },
+		[&](size_t, const RedisReply& reply) {
+			if(reply.is(REDIS_REPLY_STRING)) ids.push_back(reply.str());
+			else if(error.empty()) error = reply.str();
+		});
+	if(!error.empty()) throw std::runtime_error("XADD failed: " + error);
+	return ids;
+}
+
+void RedisKVStore::createStreamGroupInNamespace(const std::string& group, const std::string& startId, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->redisCommandArgv({"XGROUP", "CREATE", KEY_WITH_NS(key, ns), group, startId, "MKSTREAM"});
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_ERROR && reply->str().compare(0, 9, "BUSYGROUP") == 0)
+		return;
+
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STATUS);
+}
+
+std::vector<RedisKVStore::StreamEntry> RedisKVStore::readStreamGroupInNamespace(const std::string& group, const std::string& consumer, size_t count, std::chrono::milliseconds block, const std::string& key, const std::string& ns) const {
+	auto args = xreadgroupArgs(group, consumer, count, block, KEY_WITH_NS(key, ns));
+	reply_ptr reply;
+
+	if(block.count() > 0) {
+		std::lock_guard<std::mutex> lock(pImpl_->blockingMutex);
+		auto& blocker = pImpl_->blocker();
+		reply = blocker.redisCommandArgv(args);
+		if(reply.get() == nullptr) {
+			std::stringstream errMsg;
+			errMsg<<"Reply status error in "<<__func__<<", command returned nil, err: "<<blocker.err();
+			pImpl_->blocking.reset();	// reconnect on the next call
+			throw std::runtime_error(errMsg.str());
+		}
+	}
+	else reply = pImpl_->redisCommandArgv(args);
+
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_NIL)
+		return std::vector<StreamEntry>();
+
+	if(reply.get() == nullptr || reply->type() != REDIS_REPLY_MAP)
+		CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+	return reply->toFirstStreamEntries();
+}
+
+size_t RedisKVStore::acknowledgeStreamEntriesInNamespace(const std::string& group, const std::vector<std::string>& ids, const std::string& key, const std::string& ns) const {
+	if(ids.empty()) return 0;
+
+	std::vector<std::string> args{"XACK", KEY_WITH_NS(key, ns), group};
+	args.insert(args.end(), ids.begin(), ids.end());
+
+	auto reply = pImpl_->redisCommandArgv(args);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+std::vector<RedisKVStore::StreamEntry> RedisKVStore::claimStreamEntriesInNamespace(const std::string& group, const std::string& consumer, std::chrono::milliseconds minIdle, size_t count, const std::string& key, const std::string& ns) const {
+	std::vector<StreamEntry> result;
+	std::string cursor = "0-0";
+
+	/* XAUTOCLAIM scans the pending list in steps, follow its cursor until
+	 * count entries are claimed or the list is done */
+	while(result.size() < count) {
+		auto reply = pImpl_->redisCommandArgv({"XAUTOCLAIM", KEY_WITH_NS(key, ns), group, consumer,
+				std::to_string(minIdle.count()), cursor, "COUNT", std::to_string(count - result.size())});
+		CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+		if(reply->elements() < 2)
+			throw std::runtime_error("Malformed XAUTOCLAIM reply in claimStreamEntriesInNamespace");
+
+		auto claimed = reply->elementAt(1).toStreamEntries();
+		std::move(claimed.begin(), claimed.end(), std::back_inserter(result));
+
+		cursor = reply->elementAt(0).str();
+		if(cursor == "0-0") break;
+	}
+	return result;
+}
+
+/* A consumer's commands are pipelined on its own connection; inflight
+ * remembers what each unanswered one was, so replies are matched in order */
+struct RedisKVStore::StreamConsumer::State {
+	enum class Sent { ack, read, claim };
+
+	const std::function<Impl*()> connect;
+	const std::string group;
+	const std::string consumer;
+	const std::string key;
+	const StreamConsumerOptions options;
+
+	std::unique_ptr<Impl> connection;
+	std::deque<Sent> inflight;
+	std::vector<std::string> acks;		// not sent yet
+	std::vector<StreamEntry> ready;		// read, not returned yet
+	std::string claimCursor = "0-0";
+
+	State(const std::function<Impl*()>& connect, const std::string& group, const std::string& consumer,
+			const std::string& key, const StreamConsumerOptions& options) :
+		connect(connect), group(group), consumer(consumer), key(key), options(options) {}
+
+	Impl& conn() {
+		if(!connection) connection.reset(connect());
+		return *connection;
+	}
+
+	void send(Sent kind, const std::vector<std::string>& args) {
+		conn().appendCommandArgv(args);
+		inflight.push_back(kind);
+	}
+
+	void sendAcks() {
+		if(acks.empty()) return;
+		std::vector<std::string> args{"XACK", key, group};
+		args.insert(args.end(), acks.begin(), acks.end());
+		acks.clear();
+		send(Sent::ack, args);
+	}
+
+	void sendRead(std::chrono::milliseconds block) {
+		send(Sent::read, xreadgroupArgs(group, consumer, std::max<size_t>(1, options.batchSize), block, key));
+	}
+
+	void sendClaim() {
+		send(Sent::claim, {"XAUTOCLAIM", key, group, consumer, std::to_string(options.claimIdle.count()),
+				claimCursor, "COUNT", std::to_string(std::max<size_t>(1, options.batchSize))});
+	}
+
+	bool readInFlight() const {
+		return std::find(inflight.begin(), inflight.end(), Sent::read) != inflight.end();
+	}
+
+	/* wait for every reply; entries go to ready */
+	void receive() {
+		std::vector<std::pair<std::string, std::string>> unknownDeleted;
+
+		while(!inflight.empty()) {
+			Sent kind = inflight.front();
+			inflight.pop_front();
+
+			auto reply = connection->getReply();
+			if(reply.get() == nullptr) {
+				std::stringstream errMsg;
+				errMsg<<"Stream consumer "<<consumer<<" lost its connection, err: "<<connection->err();
+				throw std::runtime_error(errMsg.str());
+			}
+
+			if(reply->type() == REDIS_REPLY_ERROR) {
+				/* entries of a failed XACK stay pending, and are delivered again */
+				if(kind == Sent::ack) {
+					logger(LOGLV_ERR)<<"XACK failed for consumer "<<consumer<<": "<<reply->str()<<std::endl;
+					continue;
+				}
+				throw std::runtime_error("Stream consumer " + consumer + " failed: " + reply->str());
+			}
+
+			std::vector<StreamEntry> entries;
+			if(kind == Sent::read && reply->type() != REDIS_REPLY_NIL)
+				entries = reply->toFirstStreamEntries();
+			else if(kind == Sent::claim && reply->elements() >= 2) {
+				std::string start = claimCursor;
+				claimCursor = reply->elementAt(0).str();
+				auto claimed = reply->elementAt(1);
+				entries = claimed.toStreamEntries();
+
+				/* Redis 7 lists the ids of deleted entries on their own, 6.2
+				 * answers nil in their place and keeps them pending */
+				if(reply->elements() >= 3) {
+					for(auto& id : reply->elementAt(2).toStringVector()) acks.push_back(std::move(id));
+				}
+				else if(entries.size() < claimed.elements())
+					unknownDeleted.emplace_back(start, claimCursor == "0-0" ? "+" : "(" + claimCursor);
+			}
+
+			/* deleted entries have nothing to process, acknowledge them right away */
+			for(auto& entry : entries) {
+				if(entry.fields.empty()) acks.push_back(std::move(entry.id));
+				else ready.push_back(std::move(entry));
+			}
+		}
+
+		for(const auto& range : unknownDeleted) findDeleted(range.first, range.second);
+	}
+
+	/* acknowledge the entries pending with this consumer between start and
+	 * end that no longer exist; runs with nothing in flight */
+	void findDeleted(const std::string& start, const std::string& end) {
+		auto pending = connection->redisCommandArgv({"XPENDING", key, group, start, end,
+				std::to_string(std::max<size_t>(1, options.batchSize)), consumer});
+		if(pending.get() == nullptr || !pending->is(REDIS_REPLY_ARRAY)) {
+			logger(LOGLV_ERR)<<"XPENDING failed for consumer "<<consumer<<", deleted entries stay pending"<<std::endl;
+			return;
+		}
+
+		std::vector<std::string> ids;
+		for(size_t i=0; i<pending->elements(); i++) {
+			auto entry = pending->elementAt(i);
+			if(entry.elements() >= 1) ids.push_back(entry.elementAt(0).str());
+		}
+		connection->pipeline(ids.size(), ids.size(),
+			[&](size_t i) { return std::vector<std::string>{"XRANGE", key, ids[i], ids[i]}; },
+			[&](size_t i, const RedisReply& reply) {
+				if(reply.is(REDIS_REPLY_ARRAY) && reply.elements() == 0) acks.push_back(ids[i]);
+			});
+	}
+
+	/* after an error the connection's state is unknown, start over; entries
+	 * read and acknowledgements sent on it may be lost, and are left pending */
+	void reset() {
+		connection.reset();
+		inflight.clear();
+	}
+};
+
+RedisKVStore::StreamConsumer::StreamConsumer(State *state) : state_(state) {
+}
+
+RedisKVStore::StreamConsumer::~StreamConsumer() {
+	try { flush(); }
+	catch(const std::exception& e) {
+		logger(LOGLV_ERR)<<"Unable to send acknowledgements of consumer "<<state_->consumer<<": "<<e.what()<<std::endl;
+	}
+}
+
+std::vector<RedisKVStore::StreamEntry> RedisKVStore::StreamConsumer::next() {
+	auto& s = *state_;
+	try {
+		if(s.ready.empty()) {
+			if(!s.readInFlight()) s.sendRead(std::chrono::milliseconds(0));
+			s.receive();
+		}
+		if(s.ready.empty() && s.options.claimIdle.count() > 0) {
+			s.sendClaim();
+			s.receive();
+		}
+		if(s.ready.empty()) {
+			/* nothing new: only now block, so acknowledgements are never held
+			 * up behind a blocked read */
+			s.sendAcks();
+			s.sendRead(s.options.block);
+			s.receive();
+		}
+
+		std::vector<StreamEntry> entries;
+		entries.swap(s.ready);
+
+		/* request the next batch while this one is processed */
+		if(!entries.empty()) {
+			s.sendAcks();
+			s.sendRead(std::chrono::milliseconds(0));
+			s.conn().flush();
+		}
+		return entries;
+	}
+	catch(...) {
+		s.reset();
+		throw;
+	}
+}
+
+void RedisKVStore::StreamConsumer::acknowledge(const std::string& id) {
+	auto& s = *state_;
+	s.acks.push_back(id);
+	if(s.acks.size() < s.options.ackBatchSize) return;
+
+	try {
+		s.sendAcks();
+		s.conn().flush();
+	}
+	catch(...) {
+		s.reset();
+		throw;
+	}
+}
+
+void RedisKVStore::StreamConsumer::flush() {
+	auto& s = *state_;
+	try {
+		s.sendAcks();
+		s.receive();
+		if(!s.acks.empty()) {	// deleted entries found by a read-ahead
+			s.sendAcks();
+			s.receive();
+		}
+	}
+	catch(...) {
+		s.reset();
+		throw;
+	}
+}
+
+std::unique_ptr<RedisKVStore::StreamConsumer> RedisKVStore::streamConsumerInNamespace(const std::string& group, const std::string& consumer, const std::string& key, const std::string& ns) const {
+	return streamConsumerInNamespace(group, consumer, StreamConsumerOptions(), key, ns);
+}
+
+std::unique_ptr<RedisKVStore::StreamConsumer> RedisKVStore::streamConsumerInNamespace(const std::string& group, const std::string& consumer, const StreamConsumerOptions& options, const std::string& key, const std::string& ns) const {
+	return std::unique_ptr<StreamConsumer>(new StreamConsumer(new StreamConsumer::State(pImpl_->connector(), group, consumer, KEY_WITH_NS(key, ns), options)));
+}
+
+/* hash value operations */
+void RedisKVStore::setStringValueForFieldInHashInNamespace(const std::string& value, const std::string& field, const std::string& key, const std::string& ns) const {
+	auto reply = value.size() < REDIS_WRITE_REF_MIN ?
+		pImpl_->command<Resp::HSET>(KEY_WITH_NS(key, ns), field, value) :
+		pImpl_->redisCommandArgvRef(std::string("HSET"), KEY_WITH_NS(key, ns), field, value);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+}
+
+void RedisKVStore::setStringValuesForFieldsInHashInNamespace(const std::unordered_map<std::string, std::string>& values, const std::string& key, const std::string& ns) const {
+	if(values.empty()) return;
+
+	/* all fields in one HSET, one round-trip for the whole entity */
+	std::vector<std::string> args;
+	args.reserve(2 + values.size() * 2);
+	args.push_back("HSET");
+	args.push_back(KEY_WITH_NS(key, ns));
+	for(const auto& value : values) {
+		args.push_back(value.first);
+		args.push_back(value.second);
+	}
+
+	auto reply = pImpl_->redisCommandArgv(args);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+}
+
+std::string RedisKVStore::stringValueForFieldInHashInNamespace(const std::string& field, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->command<Resp::HGET>(KEY_WITH_NS(key, ns), field);
+	if(reply.get() != nullptr && reply->type() == REDIS_REPLY_NIL)
+		return "";
+
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_STRING);
+	return reply->str();
+}
+
+std::unordered_map<std::string, std::string> RedisKVStore::stringValuesForFieldsInHashInNamespace(const std::vector<std::string>& fields, const std::string& key, const std::string& ns) const {
+	std::unordered_map<std::string, std::string> result;
+	if(fields.empty()) return result;
+
+	std::vector<std::string> args;
+	args.reserve(2 + fields.size());
+	args.push_back("HMGET");
+	args.push_back(KEY_WITH_NS(key, ns));
+	args.insert(args.end(), fields.begin(), fields.end());
+
+	auto reply = pImpl_->redisCommandArgv(args);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+
+	result.reserve(reply->elements());
+	for(size_t i=0; i<reply->elements() && i<fields.size(); i++) {
+		auto value = reply->elementAt(i);
+		if(value.is(REDIS_REPLY_STRING)) result[fields[i]] = value.str();
+	}
+	return result;
+}
+
+std::unordered_map<std::string, std::string> RedisKVStore::hashValueForKeyInNamespace(const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->command<Resp::HGETALL>(KEY_WITH_NS(key, ns));
+
+	/* RESP3 answers with a map, RESP2 with a flat array */
+	if(reply.get() == nullptr || reply->type() != REDIS_REPLY_MAP)
+		CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+	return reply->toStringMap();
+}
+
+size_t RedisKVStore::removeFieldFromHashInNamespace(const std::string& field, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->command<Resp::HDEL>(KEY_WITH_NS(key, ns), field);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+size_t RedisKVStore::removeFieldsFromHashInNamespace(const std::vector<std::string>& fields, const std::string& key, const std::string& ns) const {
+	if(fields.empty()) return 0;
+
+	std::vector<std::string> args;
+	args.reserve(2 + fields.size());
+	args.push_back("HDEL");
+	args.push_back(KEY_WITH_NS(key, ns));
+	args.insert(args.end(), fields.begin(), fields.end());
+
+	auto reply = pImpl_->redisCommandArgv(args);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+long long RedisKVStore::incrementFieldInHashInNamespace(long long increment, const std::string& field, const std::string& key, const std::string& ns) const {
+	auto reply = pImpl_->command<Resp::HINCRBY>(KEY_WITH_NS(key, ns), field, std::to_string(increment));
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+/* pub/sub */
+void RedisKVStore::subscribe(const std::string& channel, const message_handler& handler) const {
+	pImpl_->pubsub().request(true, std::make_shared<Subscriber::Subscription>(Subscriber::Subscription{channel, false, handler, nullptr}));
+}
+
+void RedisKVStore::psubscribe(const std::string& pattern, const message_handler& handler) const {
+	pImpl_->pubsub().request(true, std::make_shared<Subscriber::Subscription>(Subscriber::Subscription{pattern, true, handler, nullptr}));
+}
+
+void RedisKVStore::subscribeBatch(const std::string& channel, const batch_handler& handler) const {
+	pImpl_->pubsub().request(true, std::make_shared<Subscriber::Subscription>(Subscriber::Subscription{channel, false, nullptr, handler}));
+}
+
+void RedisKVStore::psubscribeBatch(const std::string& pattern, const batch_handler& handler) const {
+	pImpl_->pubsub().request(true, std::make_shared<Subscriber::Subscription>(Subscriber::Subscription{pattern, true, nullptr, handler}));
+}
+
+void RedisKVStore::unsubscribe(const std::string& channel) const {
+	if(!pImpl_->subscriber) return;
+	pImpl_->subscriber->request(false, std::make_shared<Subscriber::Subscription>(Subscriber::Subscription{channel, false, nullptr, nullptr}));
+}
+
+void RedisKVStore::punsubscribe(const std::string& pattern) const {
+	if(!pImpl_->subscriber) return;
+	pImpl_->subscriber->request(false, std::make_shared<Subscriber::Subscription>(Subscriber::Subscription{pattern, true, nullptr, nullptr}));
+}
+
+size_t RedisKVStore::droppedMessages() const {
+	return pImpl_->subscriber ? pImpl_->subscriber->droppedMessages() : 0;
+}
+
+long long RedisKVStore::publish(const std::string& channel, const std::string& payload) const {
+	auto reply = payload.size() < REDIS_WRITE_REF_MIN ?
+		pImpl_->command<Resp::PUBLISH>(channel, payload) :
+		pImpl_->redisCommandArgvRef(std::string("PUBLISH"), channel, payload);
+	CHECK_REPLY_STATUS(reply, REDIS_REPLY_INTEGER);
+	return reply->integer();
+}
+
+/* local cache warm-up */
+size_t RedisKVStore::warmNamespace(const std::string& ns) const {
+	return warmNamespace(ns, WarmUpOptions());
+}
+
+size_t RedisKVStore::warmNamespace(const std::string& ns, const WarmUpOptions& options) const {
+	if(!pImpl_->cacheActive())
+		throw std::runtime_error("Local cache is disabled, set ConnectionOptions::localCacheSize and switch to RESP3");
+
+	/* escape glob metacharacters so the namespace is matched literally */
+	std::string pattern;
+	for(char c : ns) {
+		if(c == '*' || c == '?' || c == '[' || c == ']' || c == '\\') pattern.push_back('\\');
+		pattern.push_back(c);
+	}
+	pattern = ns == "" ? "*" : pattern + ":*";
+
+	size_t batchSize = options.batchSize == 0 ? 1 : options.batchSize;
+	size_t limit = std::min(options.maxKeys, pImpl_->cache.capacity());
+	size_t scanned = 0, loaded = 0;
+	std::string cursor = "0";
+
+	logger(LOGLV_DEBUG)<<"warming namespace "<<ns<<" with pattern "<<pattern<<std::endl;
+
+	do {
+		auto reply = pImpl_->redisCommandArgv({"SCAN", cursor, "MATCH", pattern, "COUNT", std::to_string(options.scanCount)});
+		CHECK_REPLY_STATUS(reply, REDIS_REPLY_ARRAY);
+		if(reply->elements() != 2)
+			throw std::runtime_error("Malformed SCAN reply in warmNamespace");
+
+		cursor = reply->elementAt(0).str();
+		auto keyReply = reply->elementAt(1);
+		std::vector<std::string> keys;
+		keys.reserve(keyReply.elements());
+		for(size_t i=0; i<keyReply.elements(); i++)
+			keys.push_back(keyReply.elementAt(i).str());
+		if(keys.size() > limit - loaded) keys.resize(limit - loaded);
+		scanned += keys.size();
+
+		/* sort keys by type, strings are fetched with MGET and sets with
+		 * SMEMBERS; the TYPEs of a page go out together in one write */
+		std::vector<std::string> stringKeys, setKeys;
+		pImpl_->pipeline(keys.size(), keys.size(),
+			[&](size_t i) { return std::vector<std::string>{"TYPE", keys[i]}; },
+			[&](size_t i, const RedisReply& type) {
+				if(!type.is(REDIS_REPLY_STATUS)) return;
+				if(type.str() == "string") stringKeys.push_back(keys[i]);
+				else if(type.str() == "set") setKeys.push_back(keys[i]);
+			});
+
+		size_t batches = (stringKeys.size() + batchSize - 1) / batchSize;
+		pImpl_->pipeline(batches, options.maxInFlight,
+			[&](size_t b) {
+				std::vector<std::string> cmd{"MGET"};
+				auto first = stringKeys.begin() + b * batchSize;
+				auto last = stringKeys.size() - b * batchSize > batchSize ? first + batchSize : stringKeys.end();
+				cmd.insert(cmd.end(), first, last);
+				return cmd;
+			},
+			[&](size_t b, const RedisReply& values) {
+				if(!values.is(REDIS_REPLY_ARRAY)) return;
+				for(size_t i=0; i<values.elements(); i++) {
+					auto value = values.elementAt(i);
+					if(!value.is(REDIS_REPLY_STRING)) continue;	// deleted since SCAN
+					pImpl_->cache.putString(stringKeys[b * batchSize + i], value.str());
+					loaded++;
+				}
+			});
+
+		pImpl_->pipeline(setKeys.size(), options.maxInFlight,
+			[&](size_t i) { return std::vector<std::string>{"SMEMBERS", setKeys[i]}; },
+			[&](size_t i, const RedisReply& members) {
+				if(!members.is(REDIS_REPLY_ARRAY)) return;
+				std::vector<std::string> result;
+				result.reserve(members.elements());
+				for(size_t j=0; j<members.elements(); j++)
+					result.push_back(members.elementAt(j).str());
+				pImpl_->cache.putSet(setKeys[i], std::move(result));
+				loaded++;
+			});
+
+		if(options.progress) options.progress(scanned, loaded);
+	} while(cursor != "0" && loaded < limit);
+
+	logger(LOGLV_INFO)<<"warmed namespace "<<ns<<", "<<loaded<<" of "<<scanned<<" keys cached"<<std::endl;
+	return loaded;
 }
@@ -1,10 +1,16 @@
 #ifndef YICPPLIB_REDISKVSTORE_H
 #define YICPPLIB_REDISKVSTORE_H
 
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "ValueCodec.h"
+
 namespace YiCppLib {
 
 	class RedisKVStore {
@@ -18,12 +24,120 @@ namespace YiCppLib {
 			using pointer = std::shared_ptr<RedisKVStore>;
 			using reply_ptr = std::unique_ptr<RedisReply>;
 
+			/* a sorted-set member and its score */
+			using scored_member = std::pair<std::string, double>;
+
+			/* socket tuning, zero keeps the system default; the TCP options
+			 * are ignored for unix sockets */
+			struct ConnectionOptions {
+				int recvBufferSize = 0;			// SO_RCVBUF, bytes
+				int sendBufferSize = 0;			// SO_SNDBUF, bytes
+				bool noDelay = true;			// TCP_NODELAY
+				bool quickAck = false;			// TCP_QUICKACK, re-armed after every read
+				int keepAliveInterval = 0;		// seconds between keepalive probes
+				int busyPoll = 0;				// SO_BUSY_POLL, microseconds
+				int spinWait = 0;				// microseconds to spin for a reply before blocking
+				std::chrono::milliseconds connectTimeout{0};
+				std::chrono::milliseconds commandTimeout{0};
+				bool lazyConnect = false;		// connect on first use instead of in the constructor
+
+				/* local cache filled by warmNamespace(); off unless localCacheSize
+				 * is set, and only used while CLIENT TRACKING keeps it coherent,
+				 * see setProtocolVersion() */
+				size_t localCacheSize = 0;		// keys held, the least recently used are evicted
+				std::chrono::milliseconds localCacheTtl{60000};	// cached keys are read from the server again after this
+
+				/* pub/sub dispatch, see subscribe() */
+				size_t subscriberThreads = 1;		// handler threads, channels are sharded across them
+				size_t subscriberQueueSize = 4096;	// messages buffered per handler thread
+				std::chrono::milliseconds subscriberBlockTimeout{100};	// wait for a full queue before dropping a message
+				size_t subscriberBatchSize = 64;	// most messages handed to a batch handler at once
+				std::chrono::milliseconds subscriberReconnectInterval{500};	// between attempts to restore a lost subscriber connection
+			};
+
+			/* a pub/sub message; pattern is empty unless it matched a psubscribe() */
+			struct Message {
+				std::string pattern;
+				std::string channel;
+				std::string payload;
+			};
+
+			using message_handler = std::function<void(const Message&)>;
+			using batch_handler = std::function<void(const std::vector<Message>&)>;
+
+			/* a stream entry, its fields and values in the order they were added;
+			 * fields is empty for an entry deleted after it was delivered */
+			using stream_fields = std::vector<std::pair<std::string, std::string>>;
+			struct StreamEntry {
+				std::string id;
+				stream_fields fields;
+			};
+
+			/* tuning for StreamConsumer */
+			struct StreamConsumerOptions {
+				size_t batchSize = 128;			// COUNT of each XREADGROUP
+				size_t ackBatchSize = 128;		// acknowledgements sent together
+				std::chrono::milliseconds block{1000};		// wait for new entries when there are none
+				std::chrono::milliseconds claimIdle{0};		// take over entries pending this long with other consumers, 0 never does
+			};
+
+			/* Reads a stream as one consumer of a group, on a connection of its
+			 * own. While a batch is being processed the next one is already
+			 * requested, and acknowledgements go out in batches along with the
+			 * reads. Entries that were read ahead but not returned when the
+			 * consumer is destroyed stay pending, for XAUTOCLAIM to recover */
+			class StreamConsumer {
+				private:
+					struct State;
+					std::unique_ptr<State> state_;
+					friend class RedisKVStore;
+					explicit StreamConsumer(State *state);
+
+				public:
+					~StreamConsumer();		// sends queued acknowledgements
+
+					/* next batch of entries, waiting up to options.block when there
+					 * are none; empty if none arrived in time */
+					std::vector<StreamEntry> next();
+
+					/* queues an acknowledgement, sent with the next read or once
+					 * ackBatchSize of them are queued */
+					void acknowledge(const std::string& id);
+
+					/* sends queued acknowledgements and waits for the server */
+					void flush();
+			};
+
+			/* tuning for warmNamespace() */
+			struct WarmUpOptions {
+				size_t scanCount = 1000;		// COUNT hint passed to SCAN
+				size_t batchSize = 256;			// keys per MGET
+				size_t maxInFlight = 16;		// pipelined commands awaiting a reply
+				size_t maxKeys = 10000;			// keys loaded at most, localCacheSize bounds them too
+				std::function<void(size_t scanned, size_t loaded)> progress;
+			};
+
 			virtual ~RedisKVStore();						// dtor
 			RedisKVStore(RedisKVStore&& rhs);				// move ctor
 			RedisKVStore& operator=(RedisKVStore&& rhs);	// move ctor
 
 			RedisKVStore(const std::string& ip, int port);
+			RedisKVStore(const std::string& ip, int port, const ConnectionOptions& options);
 			RedisKVStore(const std::string& unixPath);
+			RedisKVStore(const std::string& unixPath, const ConnectionOptions& options);
+
+			/* connects every store that is not connected yet, all handshakes
+			 * in parallel; meant for stores built with lazyConnect. Host names
+			 * are still resolved one store after the other, and each store only
+			 * tries the first address its host resolves to. Stores that fail
+			 * stay unconnected and retry on first use; returns how many did */
+			static size_t connectAll(const std::vector<pointer>& stores);
+
+			/* switch the connection to RESP2 or RESP3 via HELLO; RESP3 also turns
+			 * on CLIENT TRACKING so invalidated keys are evicted from the local
+			 * cache. The cache is only used while tracking is on, and emptied
+			 * whenever the protocol changes */
+			void setProtocolVersion(int version) const ;
 
 			/* remove key */
 			void removeKeyInNamespace(const std::string& key, const std::string& ns = "") const ;
@@ -32,15 +146,164 @@ namespace YiCppLib {
 			void setStringValueForKeyInNamespace(const std::string& value, const std::string& key, const std::string& ns = "") const ;
 			std::string stringValueForKeyInNamespace(const std::string& key, const std::string& ns = "") const ;
 
-			/* ordered-set value operations */
+			/* typed value operations, encoded with ValueCodec<T>; getValue
+			 * returns false, leaving value untouched, if key does not exist */
+			template<class T>
+			void setValue(const T& value, const std::string& key, const std::string& ns = "") const {
+				std::string encoded;
+				ValueCodec<T>::encode(value, encoded);
+				setStringValueForKeyInNamespace(encoded, key, ns);
+			}
+
+			template<class T>
+			bool getValue(T& value, const std::string& key, const std::string& ns = "") const {
+				return visitValueForKeyInNamespace(key, ns, [](const char *data, size_t size, void *out) {
+					*static_cast<T*>(out) = ValueCodec<T>::decode(data, size);
+				}, &value);
+			}
+
+			/* set value operations */
 			void addStringValueToSetInNamespace(const std::string& value, const std::string& key, const std::string& ns = "")const ;
 			std::vector<std::string> stringSetValueForKeyInNamespace(const std::string& key, const std::string& ns = "") const ;
 
+			/* calls callback for each set member as it is read off the socket,
+			 * so huge sets are never held in memory; returns the member count */
+			size_t forEachStringInSetInNamespace(const std::function<void(const std::string&)>& callback, const std::string& key, const std::string& ns = "") const ;
+
+			/* sorted-set value operations */
+			void addStringValueToSortedSetInNamespace(double score, const std::string& value, const std::string& key, const std::string& ns = "") const ;
+			size_t addStringValuesToSortedSetInNamespace(const std::vector<scored_member>& values, const std::string& key, const std::string& ns = "") const ;
+
+			/* returns the score of value after the increment */
+			double incrementScoreOfStringInSortedSetInNamespace(double increment, const std::string& value, const std::string& key, const std::string& ns = "") const ;
+
+			/* members by rank, start and stop are inclusive and may be negative
+			 * to count from the end; reverse ranges start at the highest score */
+			std::vector<scored_member> sortedSetRangeForKeyInNamespace(long long start, long long stop, const std::string& key, const std::string& ns = "") const ;
+			std::vector<scored_member> reverseSortedSetRangeForKeyInNamespace(long long start, long long stop, const std::string& key, const std::string& ns = "") const ;
+
+			/* members with min <= score <= max, lowest score first; the LIMIT
+			 * form skips offset of them and returns at most count */
+			std::vector<scored_member> sortedSetRangeByScoreForKeyInNamespace(double min, double max, const std::string& key, const std::string& ns = "") const ;
+			std::vector<scored_member> sortedSetRangeByScoreForKeyInNamespace(double min, double max, size_t offset, size_t count, const std::string& key, const std::string& ns = "") const ;
+
+			/* rank of value, lowest score first; -1 if it is not a member */
+			long long rankOfStringInSortedSetInNamespace(const std::string& value, const std::string& key, const std::string& ns = "") const ;
+
+			/* return the number of members removed */
+			size_t removeStringFromSortedSetInNamespace(const std::string& value, const std::string& key, const std::string& ns = "") const ;
+			size_t removeStringsFromSortedSetInNamespace(const std::vector<std::string>& values, const std::string& key, const std::string& ns = "") const ;
+
+			/* list value operations, for work queues: push to the back, pop from
+			 * the front. Batches go out as pipelined commands of up to
+			 * listBatchSize values each, one round-trip for all of them */
+			static constexpr size_t listBatchSize = 1024;
+
+			/* push returns the length of the list after the push */
+			size_t pushStringValuesToListInNamespace(const std::vector<std::string>& values, const std::string& key, const std::string& ns = "") const ;
+			size_t pushStringValuesToFrontOfListInNamespace(const std::vector<std::string>& values, const std::string& key, const std::string& ns = "") const ;
+
+			/* pop returns at most count values, fewer if the list runs out */
+			std::vector<std::string> popStringValuesFromListInNamespace(size_t count, const std::string& key, const std::string& ns = "") const ;
+			std::vector<std::string> popStringValuesFromBackOfListInNamespace(size_t count, const std::string& key, const std::string& ns = "") const ;
+
+			/* reliable queue: reserving moves values from the front of key to the
+			 * back of processingKey in one step, where they stay until they are
+			 * acknowledged, so the work of a consumer that died can be requeued.
+			 * The blocking form waits up to timeout (0 waits forever) for a value,
+			 * on a connection of its own, and returns false if none came; it may
+			 * run on one thread while another thread uses the store */
+			bool reserveStringValueFromListInNamespace(std::string& value, const std::string& processingKey, std::chrono::milliseconds timeout, const std::string& key, const std::string& ns = "") const ;
+			std::vector<std::string> reserveStringValuesFromListInNamespace(size_t count, const std::string& processingKey, const std::string& key, const std::string& ns = "") const ;
+
+			/* returns the number of values removed from processingKey */
+			size_t acknowledgeStringValuesInListInNamespace(const std::vector<std::string>& values, const std::string& processingKey, const std::string& ns = "") const ;
+
+			/* moves every value left in processingKey back to the front of key,
+			 * returns the number moved */
+			size_t requeueStringValuesFromListInNamespace(const std::string& processingKey, const std::string& key, const std::string& ns = "") const ;
+
+			/* stream operations; a maxLength above zero trims the stream to about
+			 * that many entries (MAXLEN ~) as entries are added. Add returns the
+			 * id of each new entry */
+			std::string addEntryToStreamInNamespace(const stream_fields& fields, const std::string& key, const std::string& ns = "", size_t maxLength = 0) const ;
+			std::vector<std::string> addEntriesToStreamInNamespace(const std::vector<stream_fields>& entries, const std::string& key, const std::string& ns = "", size_t maxLength = 0) const ;
+
+			/* creates group, and the stream if needed, reading from startId
+			 * ("$" for new entries only, "0" for the whole stream); an existing
+			 * group is left as it is */
+			void createStreamGroupInNamespace(const std::string& group, const std::string& startId, const std::string& key, const std::string& ns = "") const ;
+
+			/* up to count entries never delivered to the group; a block above
+			 * zero waits that long for some on a connection of its own, like
+			 * reserveStringValueFromListInNamespace() */
+			std::vector<StreamEntry> readStreamGroupInNamespace(const std::string& group, const std::string& consumer, size_t count, std::chrono::milliseconds block, const std::string& key, const std::string& ns = "") const ;
+
+			/* returns the number of entries acknowledged */
+			size_t acknowledgeStreamEntriesInNamespace(const std::string& group, const std::vector<std::string>& ids, const std::string& key, const std::string& ns = "") const ;
+
+			/* transfers up to count entries pending for at least minIdle with
+			 * any consumer of the group to consumer */
+			std::vector<StreamEntry> claimStreamEntriesInNamespace(const std::string& group, const std::string& consumer, std::chrono::milliseconds minIdle, size_t count, const std::string& key, const std::string& ns = "") const ;
+
+			std::unique_ptr<StreamConsumer> streamConsumerInNamespace(const std::string& group, const std::string& consumer, const std::string& key, const std::string& ns = "") const ;
+			std::unique_ptr<StreamConsumer> streamConsumerInNamespace(const std::string& group, const std::string& consumer, const StreamConsumerOptions& options, const std::string& key, const std::string& ns = "") const ;
+
+			/* hash value operations: the fields of one entity kept under a
+			 * single key, instead of a string key per field */
+			void setStringValueForFieldInHashInNamespace(const std::string& value, const std::string& field, const std::string& key, const std::string& ns = "") const ;
+			void setStringValuesForFieldsInHashInNamespace(const std::unordered_map<std::string, std::string>& values, const std::string& key, const std::string& ns = "") const ;
+			std::string stringValueForFieldInHashInNamespace(const std::string& field, const std::string& key, const std::string& ns = "") const ;
+
+			/* fields missing from the hash are missing from the result */
+			std::unordered_map<std::string, std::string> stringValuesForFieldsInHashInNamespace(const std::vector<std::string>& fields, const std::string& key, const std::string& ns = "") const ;
+			std::unordered_map<std::string, std::string> hashValueForKeyInNamespace(const std::string& key, const std::string& ns = "") const ;
+
+			/* return the number of fields removed */
+			size_t removeFieldFromHashInNamespace(const std::string& field, const std::string& key, const std::string& ns = "") const ;
+			size_t removeFieldsFromHashInNamespace(const std::vector<std::string>& fields, const std::string& key, const std::string& ns = "") const ;
+
+			/* returns the value of the field after the increment */
+			long long incrementFieldInHashInNamespace(long long increment, const std::string& field, const std::string& key, const std::string& ns = "") const ;
+
+			/* local cache warm-up: loads the string and set keys under ns, up
+			 * to maxKeys of them, into the local cache; returns the number of
+			 * keys loaded. Throws unless the cache is enabled and tracking is on */
+			size_t warmNamespace(const std::string& ns) const ;
+			size_t warmNamespace(const std::string& ns, const WarmUpOptions& options) const ;
+
+			/* pub/sub: subscriptions share a dedicated connection read by a
+			 * background thread, handlers run on subscriberThreads worker threads.
+			 * Messages of one channel (or one pattern) are handled in order, on
+			 * the same thread. Subscribing again replaces the handler; all calls
+			 * return once the server confirmed them. When the connection is lost
+			 * it is made again, trying every subscriberReconnectInterval, and
+			 * confirmed subscriptions are restored; messages published meanwhile
+			 * are lost, and subscribing throws until then */
+			void subscribe(const std::string& channel, const message_handler& handler) const ;
+			void psubscribe(const std::string& pattern, const message_handler& handler) const ;
+
+			/* like subscribe(), but consecutive messages are delivered together,
+			 * up to subscriberBatchSize at a time */
+			void subscribeBatch(const std::string& channel, const batch_handler& handler) const ;
+			void psubscribeBatch(const std::string& pattern, const batch_handler& handler) const ;
+
+			void unsubscribe(const std::string& channel) const ;
+			void punsubscribe(const std::string& pattern) const ;
+
+			/* messages dropped because their handler thread stayed behind for
+			 * longer than subscriberBlockTimeout */
+			size_t droppedMessages() const ;
+
+			/* returns the number of clients that received the message */
+			long long publish(const std::string& channel, const std::string& payload) const ;
 			
 		private:
 			
-			template<typename ... Types>
-			reply_ptr redisCommand(const std::string& cmd, const std::string& format, Types ... args) const;
+			/* passes the stored bytes of key to visit, straight from the reply
+			 * buffer; returns false, without calling it, if key does not exist */
+			bool visitValueForKeyInNamespace(const std::string& key, const std::string& ns,
+					void (*visit)(const char *data, size_t size, void *context), void *context) const;
 
 	};
 }
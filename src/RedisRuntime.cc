@@ -0,0 +1,567 @@
+#include "RedisRuntime.h"
+#include "SpscQueue.h"
+#include "hiredis.h"
+#include "async.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "log.h"
+
+using namespace YiCppLib;
+
+#ifndef LOGLVL
+#define LOGLVL LOGLV_WARN
+#endif
+
+static auto logger = LOGGER(LOGLVL);
+
+/* submitting threads that get their own SPSC queue on each connection, any
+ * further ones share a locked queue */
+static constexpr size_t maxProducers = 64;
+
+namespace {
+	struct Loop;
+
+	struct Endpoint {
+		std::string address;
+		int port;				// 0 for a unix socket
+	};
+
+	struct Task {
+		std::vector<std::string> args;
+		RedisRuntime::callback cb;
+	};
+
+	/* An async connection with its submission queues. It belongs to one loop
+	 * at a time, and only that loop's thread touches the context, the queue
+	 * consumer side and the in-flight callbacks. */
+	struct Connection {
+		const Endpoint& endpoint;
+		const size_t queueSize;
+
+		redisAsyncContext *ac = nullptr;
+		Loop *loop = nullptr;					// owner, nullptr while handed over
+		std::atomic<Loop*> owner{nullptr};		// for submitting threads to wake
+		bool registered = false;				// socket is in the owner's epoll set
+		bool wantRead = false;
+		bool wantWrite = false;
+		uint32_t events = 0;					// registered epoll events
+
+		std::deque<RedisRuntime::callback> inflight;	// replies arrive in order
+		std::atomic<size_t> backlog{0};					// commands queued or in flight
+
+		std::array<std::atomic<SpscQueue<Task>*>, maxProducers> queues;	// slot i is created by producer i
+		std::mutex overflowMutex;
+		std::deque<Task> overflow;
+
+		Connection(const Endpoint& endpoint, size_t queueSize) : endpoint(endpoint), queueSize(queueSize) {
+			for(auto& queue : queues) queue.store(nullptr);
+		}
+
+		~Connection() {
+			for(auto& queue : queues) delete queue.load();
+		}
+	};
+
+	/* An I/O thread with its epoll set; other threads only reach it through
+	 * its eventfd and the control lists */
+	struct Loop {
+		const size_t index;
+		std::thread thread;
+		int epfd = -1;
+		int wakefd = -1;
+		std::vector<Connection*> connections;	// loop thread only
+
+		std::atomic<bool> sleeping{false};
+		std::atomic<size_t> load{0};			// backlog of its connections, published for idle loops
+		std::atomic<size_t> owned{0};			// connections.size(), published
+		std::atomic<bool> awaitingSteal{false};	// asked another loop for a connection
+
+		std::mutex controlMutex;
+		std::vector<Connection*> handoffs;		// connections given to this loop
+		std::vector<Loop*> thieves;				// idle loops asking for a connection
+
+		explicit Loop(size_t index) : index(index) {}
+
+		void wake() {
+			uint64_t one = 1;
+			if(write(wakefd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+				logger(LOGLV_ERR)<<"Unable to wake I/O thread "<<index<<", err: "<<errno<<std::endl;
+		}
+	};
+}
+
+struct RedisRuntime::Impl {
+	const Endpoint endpoint;
+	const Options options;
+	const uint64_t id;
+
+	std::vector<std::unique_ptr<Loop>> loops;
+	std::vector<Connection*> connections;	// indexed by shard, each created by its first loop
+	std::atomic<size_t> producers{0};
+	std::atomic<bool> stopping{false};
+
+	/* startup handshake with the loops */
+	std::mutex startMutex;
+	std::condition_variable started;
+	size_t ready = 0;
+	std::string startError;
+
+	Impl(const Endpoint& endpoint, const Options& options) : endpoint(endpoint), options(options), id(nextId()) {
+		size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+		size_t perThread = std::max<size_t>(1, options.connectionsPerThread);
+		connections.resize(threads * perThread, nullptr);
+
+		for(size_t i=0; i<threads; i++) loops.emplace_back(new Loop(i));
+		for(auto& loop : loops) {
+			Loop *l = loop.get();
+			l->thread = std::thread([this, l, perThread] { run(*l, perThread); });
+		}
+
+		std::unique_lock<std::mutex> lock(startMutex);
+		started.wait(lock, [this] { return ready == loops.size(); });
+		if(!startError.empty()) {
+			lock.unlock();
+			shutdown();
+			throw std::runtime_error("Unable to start runtime: " + startError);
+		}
+	}
+
+	~Impl() {
+		shutdown();
+	}
+
+	static uint64_t nextId() {
+		static std::atomic<uint64_t> ids{1};
+		return ids.fetch_add(1);
+	}
+
+	/* index of the calling thread among the submitting threads */
+	size_t producerId() {
+		static thread_local std::unordered_map<uint64_t, size_t> ids;
+		auto found = ids.find(id);
+		if(found != ids.end()) return found->second;
+		return ids[id] = producers.fetch_add(1);
+	}
+
+	void shutdown() {
+		if(stopping.exchange(true)) return;
+		for(auto& loop : loops) loop->wake();
+		for(auto& loop : loops) if(loop->thread.joinable()) loop->thread.join();
+
+		/* every thread is gone, fail whatever is left */
+		for(auto connection : connections) {
+			if(connection == nullptr) continue;
+			if(connection->ac != nullptr) redisAsyncFree(connection->ac);
+			Task task;
+			for(auto& queue : connection->queues) {
+				auto q = queue.load();
+				while(q != nullptr && q->tryPop(task)) complete(task.cb, nullptr);
+			}
+			for(auto& task : connection->overflow) complete(task.cb, nullptr);
+			delete connection;
+		}
+		for(auto& loop : loops) {
+			if(loop->epfd != -1) close(loop->epfd);
+			if(loop->wakefd != -1) close(loop->wakefd);
+		}
+	}
+
+	static void complete(const RedisRuntime::callback& cb, redisReply *reply) {
+		if(!cb) return;
+		try { cb(reply); }
+		catch(const std::exception& e) {
+			logger(LOGLV_ERR)<<"Reply callback threw: "<<e.what()<<std::endl;
+		}
+		catch(...) {
+			logger(LOGLV_ERR)<<"Reply callback threw"<<std::endl;
+		}
+	}
+
+	/* submitting side */
+	void submit(Connection& connection, Task&& task) {
+		size_t producer = producerId();
+		connection.backlog.fetch_add(1);
+
+		if(producer < maxProducers) {
+			auto queue = connection.queues[producer].load(std::memory_order_acquire);
+			if(queue == nullptr) {
+				queue = new SpscQueue<Task>(connection.queueSize);
+				connection.queues[producer].store(queue, std::memory_order_release);
+			}
+			if(!queue->tryPush(std::move(task))) {
+				/* the loop is queueSize commands behind this thread: fail
+				 * the command rather than wait, which could be forever when
+				 * called from a callback on that very loop */
+				connection.backlog.fetch_sub(1);
+				wakeOwner(connection);
+				complete(task.cb, nullptr);
+				return;
+			}
+		}
+		else {
+			std::lock_guard<std::mutex> lock(connection.overflowMutex);
+			connection.overflow.push_back(std::move(task));
+		}
+		wakeOwner(connection);
+	}
+
+	static void wakeOwner(Connection& connection) {
+		/* pairs with the fence in run(), so either the loop sees the command
+		 * or we see it sleeping */
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		Loop *owner = connection.owner.load();
+		if(owner != nullptr && owner->sleeping.load(std::memory_order_relaxed)) owner->wake();
+	}
+
+	/* event hooks of the async contexts, they keep the epoll set in sync */
+	static void addRead(void *privdata) { static_cast<Connection*>(privdata)->wantRead = true; updateEvents(*static_cast<Connection*>(privdata)); }
+	static void delRead(void *privdata) { static_cast<Connection*>(privdata)->wantRead = false; updateEvents(*static_cast<Connection*>(privdata)); }
+	static void addWrite(void *privdata) { static_cast<Connection*>(privdata)->wantWrite = true; updateEvents(*static_cast<Connection*>(privdata)); }
+	static void delWrite(void *privdata) { static_cast<Connection*>(privdata)->wantWrite = false; updateEvents(*static_cast<Connection*>(privdata)); }
+
+	static void cleanup(void *privdata) {
+		auto connection = static_cast<Connection*>(privdata);
+		connection->wantRead = connection->wantWrite = false;
+		unregister(*connection);
+	}
+
+	static void updateEvents(Connection& connection) {
+		uint32_t events = (connection.wantRead ? uint32_t(EPOLLIN) : 0) | (connection.wantWrite ? uint32_t(EPOLLOUT) : 0);
+		if(!connection.registered || events == connection.events) return;
+
+		struct epoll_event ev = {};
+		ev.events = events;
+		ev.data.ptr = &connection;
+		if(epoll_ctl(connection.loop->epfd, EPOLL_CTL_MOD, connection.ac->c.fd, &ev) == -1)
+			logger(LOGLV_ERR)<<"epoll_ctl(EPOLL_CTL_MOD) failed, err: "<<errno<<std::endl;
+		connection.events = events;
+	}
+
+	static void registerWith(Connection& connection, Loop& loop) {
+		connection.loop = &loop;
+		if(connection.ac == nullptr) return;
+
+		struct epoll_event ev = {};
+		connection.events = ev.events = (connection.wantRead ? uint32_t(EPOLLIN) : 0) | (connection.wantWrite ? uint32_t(EPOLLOUT) : 0);
+		ev.data.ptr = &connection;
+		if(epoll_ctl(loop.epfd, EPOLL_CTL_ADD, connection.ac->c.fd, &ev) == -1)
+			logger(LOGLV_ERR)<<"epoll_ctl(EPOLL_CTL_ADD) failed, err: "<<errno<<std::endl;
+		else connection.registered = true;
+	}
+
+	static void unregister(Connection& connection) {
+		if(!connection.registered) return;
+		epoll_ctl(connection.loop->epfd, EPOLL_CTL_DEL, connection.ac->c.fd, nullptr);
+		connection.registered = false;
+	}
+
+	static void onDisconnect(const redisAsyncContext *ac, int status) {
+		auto connection = static_cast<Connection*>(ac->data);
+		connection->ac = nullptr;
+		if(status != REDIS_OK)
+			logger(LOGLV_ERR)<<"Runtime connection lost, err: "<<ac->errstr<<std::endl;
+	}
+
+	static void onReply(redisAsyncContext *, void *reply, void *privdata) {
+		auto connection = static_cast<Connection*>(privdata);
+		auto cb = std::move(connection->inflight.front());
+		connection->inflight.pop_front();
+		connection->backlog.fetch_sub(1);
+		complete(cb, static_cast<redisReply*>(reply));
+	}
+
+	/* loop side: (re)connect on the owner's thread */
+	bool connect(Connection& connection) {
+		auto ac = endpoint.port ? redisAsyncConnect(endpoint.address.c_str(), endpoint.port) :
+			redisAsyncConnectUnix(endpoint.address.c_str());
+		if(ac == nullptr || ac->err) {
+			logger(LOGLV_ERR)<<"Runtime connection was not established, err: "<<(ac ? ac->errstr : "out of memory")<<std::endl;
+			if(ac != nullptr) redisAsyncFree(ac);
+			return false;
+		}
+
+		ac->data = &connection;
+		ac->ev.data = &connection;
+		ac->ev.addRead = addRead;
+		ac->ev.delRead = delRead;
+		ac->ev.addWrite = addWrite;
+		ac->ev.delWrite = delWrite;
+		ac->ev.cleanup = cleanup;
+		redisAsyncSetDisconnectCallback(ac, onDisconnect);
+
+		connection.ac = ac;
+		connection.wantRead = false;
+		connection.wantWrite = true;	// a write event completes the connect
+		registerWith(connection, *connection.loop);
+		return true;
+	}
+
+	void send(Connection& connection, Task&& task) {
+		if(connection.ac == nullptr && !connect(connection)) {
+			connection.backlog.fetch_sub(1);
+			complete(task.cb, nullptr);
+			return;
+		}
+
+		std::vector<const char*> argv;
+		std::vector<size_t> argvlen;
+		argv.reserve(task.args.size());
+		argvlen.reserve(task.args.size());
+		for(const auto& arg : task.args) {
+			argv.push_back(arg.data());
+			argvlen.push_back(arg.size());
+		}
+
+		if(redisAsyncCommandArgv(connection.ac, onReply, &connection, (int)argv.size(), argv.data(), argvlen.data()) != REDIS_OK) {
+			connection.backlog.fetch_sub(1);
+			complete(task.cb, nullptr);
+			return;
+		}
+		connection.inflight.push_back(std::move(task.cb));
+	}
+
+	/* send everything queued on a connection, returns whether there was any */
+	bool drain(Connection& connection) {
+		bool worked = false;
+		Task task;
+
+		size_t n = std::min(producers.load(std::memory_order_acquire), maxProducers);
+		for(size_t i=0; i<n; i++) {
+			auto queue = connection.queues[i].load(std::memory_order_acquire);
+			while(queue != nullptr && queue->tryPop(task)) {
+				send(connection, std::move(task));
+				worked = true;
+			}
+		}
+
+		std::deque<Task> overflow;
+		{
+			std::lock_guard<std::mutex> lock(connection.overflowMutex);
+			overflow.swap(connection.overflow);
+		}
+		for(auto& queued : overflow) {
+			send(connection, std::move(queued));
+			worked = true;
+		}
+		return worked;
+	}
+
+	bool queued(Connection& connection) {
+		size_t n = std::min(producers.load(std::memory_order_acquire), maxProducers);
+		for(size_t i=0; i<n; i++) {
+			auto queue = connection.queues[i].load(std::memory_order_acquire);
+			if(queue != nullptr && !queue->empty()) return true;
+		}
+		std::lock_guard<std::mutex> lock(connection.overflowMutex);
+		return !connection.overflow.empty();
+	}
+
+	/* connections handed to this loop, and requests for one of ours */
+	void control(Loop& loop) {
+		std::vector<Connection*> handoffs;
+		std::vector<Loop*> thieves;
+		{
+			std::lock_guard<std::mutex> lock(loop.controlMutex);
+			handoffs.swap(loop.handoffs);
+			thieves.swap(loop.thieves);
+		}
+
+		for(auto connection : handoffs) {
+			registerWith(*connection, loop);
+			loop.connections.push_back(connection);
+		}
+
+		for(auto thief : thieves) {
+			/* give away the busiest connection that carries at most half of
+			 * our backlog; moving a bigger one would only move the hot spot,
+			 * and have the two loops pass it back and forth */
+			size_t load = 0;
+			for(auto connection : loop.connections) load += connection->backlog.load();
+
+			auto busiest = loop.connections.end();
+			size_t most = 0;
+			for(auto it = loop.connections.begin(); it != loop.connections.end(); ++it) {
+				size_t backlog = (*it)->backlog.load();
+				if(backlog > most && backlog <= load / 2) {
+					most = backlog;
+					busiest = it;
+				}
+			}
+
+			if(loop.connections.size() >= 2 && busiest != loop.connections.end()) {
+				Connection *connection = *busiest;
+				loop.connections.erase(busiest);
+				unregister(*connection);
+				connection->loop = nullptr;
+				connection->owner.store(thief);
+
+				logger(LOGLV_DEBUG)<<"I/O thread "<<thief->index<<" takes over a connection of "<<loop.index<<std::endl;
+				{
+					std::lock_guard<std::mutex> lock(thief->controlMutex);
+					thief->handoffs.push_back(connection);
+				}
+				thief->wake();
+			}
+			thief->awaitingSteal.store(false);
+		}
+		loop.owned.store(loop.connections.size());
+	}
+
+	/* an idle loop asks the most loaded one above the threshold for a connection */
+	void steal(Loop& loop) {
+		if(loop.awaitingSteal.load()) return;
+
+		Loop *victim = nullptr;
+		size_t most = options.stealThreshold;
+		for(auto& other : loops) {
+			if(other.get() == &loop || other->owned.load() < 2) continue;
+			if(other->load.load() > most) {
+				most = other->load.load();
+				victim = other.get();
+			}
+		}
+		if(victim == nullptr) return;
+
+		loop.awaitingSteal.store(true);
+		{
+			std::lock_guard<std::mutex> lock(victim->controlMutex);
+			victim->thieves.push_back(&loop);
+		}
+		victim->wake();
+	}
+
+	void pin(Loop& loop) {
+#ifdef __linux__
+		unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(loop.index % cores, &set);
+		if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			logger(LOGLV_WARN)<<"Unable to pin I/O thread "<<loop.index<<" to core "<<loop.index % cores<<std::endl;
+#endif
+	}
+
+	void run(Loop& loop, size_t perThread) {
+		/* pin before allocating anything, so that first-touch places the
+		 * loop's state in memory local to its core */
+		if(options.pinThreads) pin(loop);
+
+		std::string error;
+		loop.epfd = epoll_create1(EPOLL_CLOEXEC);
+		loop.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(loop.epfd == -1 || loop.wakefd == -1) error = "unable to create epoll or eventfd";
+		else {
+			struct epoll_event ev = {};
+			ev.events = EPOLLIN;
+			ev.data.ptr = nullptr;
+			epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.wakefd, &ev);
+		}
+
+		for(size_t i=0; i<perThread && error.empty(); i++) {
+			auto connection = new Connection(endpoint, std::max<size_t>(1, options.queueSize));
+			connection->loop = &loop;
+			connection->owner.store(&loop);
+			connections[loop.index * perThread + i] = connection;
+			loop.connections.push_back(connection);
+			if(!connect(*connection)) error = "unable to connect to database";
+		}
+		loop.owned.store(loop.connections.size());
+
+		{
+			std::lock_guard<std::mutex> lock(startMutex);
+			if(!error.empty()) startError = error;
+			ready++;
+		}
+		started.notify_all();
+		if(!error.empty()) return;
+
+		struct epoll_event events[64];
+		while(!stopping.load()) {
+			control(loop);
+
+			bool worked = false;
+			size_t load = 0;
+			for(auto connection : loop.connections) {
+				worked |= drain(*connection);
+				load += connection->backlog.load();
+			}
+			loop.load.store(load);
+
+			int timeout = 0;
+			if(!worked) {
+				loop.sleeping.store(true, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				bool pending = std::any_of(loop.connections.begin(), loop.connections.end(),
+						[this](Connection *connection) { return queued(*connection); });
+				if(!pending) {
+					if(load == 0 && loops.size() > 1) steal(loop);
+					timeout = loops.size() > 1 ? (int)options.idleCheck.count() : -1;
+				}
+			}
+
+			int n = epoll_wait(loop.epfd, events, 64, timeout);
+			loop.sleeping.store(false, std::memory_order_relaxed);
+			if(n == -1 && errno != EINTR) {
+				logger(LOGLV_ERR)<<"epoll_wait failed in I/O thread "<<loop.index<<", err: "<<errno<<std::endl;
+				break;
+			}
+
+			for(int i=0; i<n; i++) {
+				if(events[i].data.ptr == nullptr) {
+					uint64_t count;
+					while(read(loop.wakefd, &count, sizeof(count)) > 0);
+					continue;
+				}
+
+				auto connection = static_cast<Connection*>(events[i].data.ptr);
+				if(connection->ac != nullptr && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+					redisAsyncHandleRead(connection->ac);
+				if(connection->ac != nullptr && (events[i].events & EPOLLOUT))
+					redisAsyncHandleWrite(connection->ac);
+			}
+		}
+	}
+};
+
+RedisRuntime::RedisRuntime(const std::string& ip, int port, const Options& options) :
+	pImpl_(new Impl(Endpoint{ip, port}, options)) {
+}
+
+RedisRuntime::RedisRuntime(const std::string& unixPath, const Options& options) :
+	pImpl_(new Impl(Endpoint{unixPath, 0}, options)) {
+}
+
+RedisRuntime::~RedisRuntime() = default;
+
+size_t RedisRuntime::threads() const {
+	return pImpl_->loops.size();
+}
+
+size_t RedisRuntime::connections() const {
+	return pImpl_->connections.size();
+}
+
+size_t RedisRuntime::shardForKey(const std::string& key) const {
+	return std::hash<std::string>()(key) % pImpl_->connections.size();
+}
+
+void RedisRuntime::command(size_t shard, std::vector<std::string> args, callback cb) const {
+	if(args.empty()) throw std::invalid_argument("empty command");
+	auto connection = pImpl_->connections[shard % pImpl_->connections.size()];
+	pImpl_->submit(*connection, Task{std::move(args), std::move(cb)});
+}
@@ -0,0 +1,60 @@
+#ifndef YICPPLIB_REDISRUNTIME_H
+#define YICPPLIB_REDISRUNTIME_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct redisReply;
+
+namespace YiCppLib {
+
+	/* Shared-nothing async client: one I/O thread per core, each running its
+	 * own epoll loop over the async connections it owns. A command is routed
+	 * by shard to a connection, and queued on that connection from the
+	 * submitting thread through a lock-free SPSC queue. Loops that run out of
+	 * work take over whole connections from overloaded loops, so the commands
+	 * of one connection are always sent, and answered, in submission order. */
+	class RedisRuntime {
+		private:
+			struct Impl;
+			std::unique_ptr<Impl> pImpl_;
+
+		public:
+			struct Options {
+				size_t threads = 0;					// I/O threads, 0 for one per core
+				size_t connectionsPerThread = 2;	// connections each thread starts out with
+				bool pinThreads = true;				// pin I/O thread i to core i
+				size_t queueSize = 1024;			// commands queued per submitting thread and connection
+				size_t stealThreshold = 64;			// commands a loop must have pending before idle loops take over one of its connections
+				std::chrono::milliseconds idleCheck{2};	// how often an idle loop looks for connections to take over
+			};
+
+			/* callback for a reply, run on the I/O thread owning the connection;
+			 * reply is only valid during the call, and nullptr if the command
+			 * could not be completed */
+			using callback = std::function<void(redisReply *reply)>;
+
+			RedisRuntime(const std::string& ip, int port, const Options& options);
+			RedisRuntime(const std::string& unixPath, const Options& options);
+			~RedisRuntime();
+
+			RedisRuntime(const RedisRuntime&) = delete;
+			RedisRuntime& operator=(const RedisRuntime&) = delete;
+
+			size_t threads() const;
+			size_t connections() const;
+
+			/* shard of a key, commands on one shard share a connection */
+			size_t shardForKey(const std::string& key) const;
+
+			/* queue a command on the connection of shard; thread-safe. Each
+			 * thread queues up to queueSize commands per connection, beyond
+			 * that cb is called at once, on the calling thread, with nullptr */
+			void command(size_t shard, std::vector<std::string> args, callback cb) const;
+	};
+}
+
+#endif
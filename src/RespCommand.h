@@ -0,0 +1,132 @@
+#ifndef YICPPLIB_RESPCOMMAND_H
+#define YICPPLIB_RESPCOMMAND_H
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+/*
+ * Encoders for fixed-arity commands. The protocol prefix of a command, e.g.
+ * "*3\r\n$3\r\nSET\r\n", is generated at compile time, so encoding at runtime
+ * is one memcpy for the prefix plus a length header and a memcpy for each
+ * argument. Output is written in a single pass into space reserved with
+ * maxEncodedSize().
+ */
+
+namespace YiCppLib {
+	namespace Resp {
+
+		/* commands: name and arity, including the command name itself */
+		struct SET { static constexpr const char *name() { return "SET"; } static constexpr size_t arity = 3; };
+		struct GET { static constexpr const char *name() { return "GET"; } static constexpr size_t arity = 2; };
+		struct DEL { static constexpr const char *name() { return "DEL"; } static constexpr size_t arity = 2; };
+		struct SADD { static constexpr const char *name() { return "SADD"; } static constexpr size_t arity = 3; };
+		struct SMEMBERS { static constexpr const char *name() { return "SMEMBERS"; } static constexpr size_t arity = 2; };
+		struct HSET { static constexpr const char *name() { return "HSET"; } static constexpr size_t arity = 4; };
+		struct HGET { static constexpr const char *name() { return "HGET"; } static constexpr size_t arity = 3; };
+		struct HDEL { static constexpr const char *name() { return "HDEL"; } static constexpr size_t arity = 3; };
+		struct HINCRBY { static constexpr const char *name() { return "HINCRBY"; } static constexpr size_t arity = 4; };
+		struct HGETALL { static constexpr const char *name() { return "HGETALL"; } static constexpr size_t arity = 2; };
+		struct ZADD { static constexpr const char *name() { return "ZADD"; } static constexpr size_t arity = 4; };
+		struct ZINCRBY { static constexpr const char *name() { return "ZINCRBY"; } static constexpr size_t arity = 4; };
+		struct ZRANK { static constexpr const char *name() { return "ZRANK"; } static constexpr size_t arity = 3; };
+		struct ZREM { static constexpr const char *name() { return "ZREM"; } static constexpr size_t arity = 3; };
+		struct PUBLISH { static constexpr const char *name() { return "PUBLISH"; } static constexpr size_t arity = 3; };
+
+		namespace detail {
+			template<size_t ... I> struct indices {};
+			template<size_t N, size_t ... I> struct makeIndices : makeIndices<N - 1, N - 1, I...> {};
+			template<size_t ... I> struct makeIndices<0, I...> { typedef indices<I...> type; };
+
+			constexpr size_t length(const char *s) { return *s ? 1 + length(s + 1) : 0; }
+			constexpr size_t digits(size_t n) { return n < 10 ? 1 : 1 + digits(n / 10); }
+			constexpr size_t pow10(size_t n) { return n == 0 ? 1 : 10 * pow10(n - 1); }
+
+			/* k-th decimal digit of n, most significant first */
+			constexpr char digitAt(size_t n, size_t k) { return '0' + (n / pow10(digits(n) - 1 - k)) % 10; }
+
+			/* i-th byte of "*<arity>\r\n$<len>\r\n<name>\r\n", where a, b, c and d
+			 * are the offsets of "\r\n$", the name length, "\r\n" and the name */
+			constexpr char prefixAt(size_t arity, const char *name, size_t len, size_t i,
+					size_t a, size_t b, size_t c, size_t d) {
+				return i == 0 ? '*' :
+					i < a ? digitAt(arity, i - 1) :
+					i < b ? "\r\n$"[i - a] :
+					i < c ? digitAt(len, i - b) :
+					i < d ? "\r\n"[i - c] :
+					i < d + len ? name[i - d] : "\r\n"[i - d - len];
+			}
+
+			constexpr char prefixAt(size_t arity, const char *name, size_t len, size_t i) {
+				return prefixAt(arity, name, len, i, 1 + digits(arity), 4 + digits(arity),
+						4 + digits(arity) + digits(len), 6 + digits(arity) + digits(len));
+			}
+		}
+
+		template<class Command>
+		struct Prefix {
+			static constexpr size_t nameLength = detail::length(Command::name());
+			static constexpr size_t size = 1 + detail::digits(Command::arity) + 3 +
+				detail::digits(nameLength) + 2 + nameLength + 2;
+
+			template<size_t ... I>
+			static constexpr std::array<char, size> build(detail::indices<I...>) {
+				return {{ detail::prefixAt(Command::arity, Command::name(), nameLength, I)... }};
+			}
+
+			static constexpr std::array<char, size> value = build(typename detail::makeIndices<size>::type());
+		};
+
+		template<class Command>
+		constexpr std::array<char, Prefix<Command>::size> Prefix<Command>::value;
+
+		namespace detail {
+			/* longest "$<len>\r\n" plus the trailing "\r\n" of an argument */
+			static constexpr size_t argOverhead = 1 + 20 + 2 + 2;
+
+			inline size_t argsSize() { return 0; }
+
+			template<class Arg, class ... Args>
+			inline size_t argsSize(const Arg& arg, const Args&... args) {
+				return arg.size() + argOverhead + argsSize(args...);
+			}
+
+			inline char *encodeArgs(char *out) { return out; }
+
+			template<class Arg, class ... Args>
+			inline char *encodeArgs(char *out, const Arg& arg, const Args&... args) {
+				char digits[20];
+				char *p = digits + sizeof(digits);
+				size_t n = arg.size();
+				do { *--p = '0' + n % 10; n /= 10; } while(n);
+
+				*out++ = '$';
+				std::memcpy(out, p, digits + sizeof(digits) - p);
+				out += digits + sizeof(digits) - p;
+				*out++ = '\r'; *out++ = '\n';
+				std::memcpy(out, arg.data(), arg.size());
+				out += arg.size();
+				*out++ = '\r'; *out++ = '\n';
+				return encodeArgs(out, args...);
+			}
+		}
+
+		/* upper bound of the encoded size of a command */
+		template<class Command, class ... Args>
+		inline size_t maxEncodedSize(const Args&... args) {
+			return Prefix<Command>::size + detail::argsSize(args...);
+		}
+
+		/* encode a command into out, which must hold maxEncodedSize() bytes;
+		 * returns the number of bytes written */
+		template<class Command, class ... Args>
+		inline size_t encode(char *out, const Args&... args) {
+			static_assert(sizeof...(Args) + 1 == Command::arity, "wrong number of arguments for command");
+
+			std::memcpy(out, Prefix<Command>::value.data(), Prefix<Command>::size);
+			return detail::encodeArgs(out + Prefix<Command>::size, args...) - out;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef YICPPLIB_SPSCQUEUE_H
+#define YICPPLIB_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/*
+ * Bounded lock-free queue for exactly one producer thread and one consumer
+ * thread. Each side caches the other side's index and only reloads it when
+ * the queue looks full (or empty), so the shared cache lines are touched
+ * once per batch rather than once per element.
+ */
+
+namespace YiCppLib {
+
+	template<class T>
+	class SpscQueue {
+		private:
+			static constexpr size_t cacheLine = 64;
+
+			std::vector<T> slots_;
+			const size_t mask_;
+
+			/* padding keeps each side's fields on its own cache line, without
+			 * requiring over-aligned allocation */
+			char pad0_[cacheLine];
+			std::atomic<size_t> head_{0};	// next slot to pop, written by the consumer
+			size_t tailCache_ = 0;			// consumer's copy of tail_
+
+			char pad1_[cacheLine];
+			std::atomic<size_t> tail_{0};	// next slot to push, written by the producer
+			size_t headCache_ = 0;			// producer's copy of head_
+			char pad2_[cacheLine];
+
+			static size_t roundUp(size_t n) {
+				size_t size = 2;
+				while(size < n) size *= 2;
+				return size;
+			}
+
+		public:
+			/* capacity is rounded up to a power of two */
+			explicit SpscQueue(size_t capacity) : slots_(roundUp(capacity)), mask_(slots_.size() - 1) {}
+
+			SpscQueue(const SpscQueue&) = delete;
+			SpscQueue& operator=(const SpscQueue&) = delete;
+
+			size_t capacity() const { return slots_.size(); }
+
+			/* producer side, false if the queue is full */
+			bool tryPush(T&& value) {
+				size_t tail = tail_.load(std::memory_order_relaxed);
+				if(tail - headCache_ == slots_.size()) {
+					headCache_ = head_.load(std::memory_order_acquire);
+					if(tail - headCache_ == slots_.size()) return false;
+				}
+
+				slots_[tail & mask_] = std::move(value);
+				tail_.store(tail + 1, std::memory_order_release);
+				return true;
+			}
+
+			/* consumer side, false if the queue is empty */
+			bool tryPop(T& value) {
+				size_t head = head_.load(std::memory_order_relaxed);
+				if(head == tailCache_) {
+					tailCache_ = tail_.load(std::memory_order_acquire);
+					if(head == tailCache_) return false;
+				}
+
+				value = std::move(slots_[head & mask_]);
+				slots_[head & mask_] = T();
+				head_.store(head + 1, std::memory_order_release);
+				return true;
+			}
+
+			/* either side; a snapshot that may be stale by the time it returns */
+			bool empty() const {
+				return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+			}
+	};
+}
+
+#endif
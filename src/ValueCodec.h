@@ -0,0 +1,131 @@
+#ifndef YICPPLIB_VALUECODEC_H
+#define YICPPLIB_VALUECODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Binary encodings of typed values, used by RedisKVStore::setValue() and
+ * getValue(). ValueCodec<T> provides
+ *
+ *     static void encode(const T& value, std::string& out);
+ *     static T decode(const char *data, size_t size);
+ *
+ * Integers, floats and doubles are stored as fixed-width little-endian
+ * bytes, so any host reads them back. Other trivially copyable types, and
+ * vectors of them, are stored as their raw bytes, which only hosts with
+ * the same layout and byte order can read. Specialize ValueCodec for any
+ * other type.
+ */
+
+namespace YiCppLib {
+
+	namespace detail {
+		template<class T> struct isPortableScalar : std::integral_constant<bool,
+			(std::is_integral<T>::value && !std::is_same<T, bool>::value) ||
+			std::is_same<T, float>::value || std::is_same<T, double>::value> {};
+
+		inline void checkSize(size_t size, size_t expected) {
+			if(size != expected)
+				throw std::runtime_error("Stored value has " + std::to_string(size) + " bytes, expected " + std::to_string(expected));
+		}
+
+		/* shifts rather than memcpy, so the result is little-endian on every
+		 * host; compilers turn them into a plain load or store on x86 */
+		template<class U>
+		inline void storeLittleEndian(U value, char *out) {
+			for(size_t i=0; i<sizeof(U); i++) out[i] = char(value >> (8 * i));
+		}
+
+		template<class U>
+		inline U loadLittleEndian(const char *data) {
+			U value = 0;
+			for(size_t i=0; i<sizeof(U); i++) value |= U((unsigned char)data[i]) << (8 * i);
+			return value;
+		}
+	}
+
+	template<class T, class Enable = void>
+	struct ValueCodec {
+		static_assert(sizeof(T) == 0, "no ValueCodec for this type, specialize YiCppLib::ValueCodec");
+	};
+
+	template<>
+	struct ValueCodec<std::string> {
+		static void encode(const std::string& value, std::string& out) { out = value; }
+		static std::string decode(const char *data, size_t size) { return std::string(data, size); }
+	};
+
+	template<class T>
+	struct ValueCodec<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+		typedef typename std::make_unsigned<T>::type bits;
+
+		static void encode(const T& value, std::string& out) {
+			char bytes[sizeof(T)];
+			detail::storeLittleEndian(bits(value), bytes);
+			out.assign(bytes, sizeof(T));
+		}
+
+		static T decode(const char *data, size_t size) {
+			detail::checkSize(size, sizeof(T));
+			return T(detail::loadLittleEndian<bits>(data));
+		}
+	};
+
+	template<class T>
+	struct ValueCodec<T, typename std::enable_if<std::is_same<T, float>::value || std::is_same<T, double>::value>::type> {
+		typedef typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type bits;
+		static_assert(sizeof(T) == sizeof(bits), "unexpected floating point size");
+
+		static void encode(const T& value, std::string& out) {
+			bits raw;
+			std::memcpy(&raw, &value, sizeof(raw));
+			char bytes[sizeof(T)];
+			detail::storeLittleEndian(raw, bytes);
+			out.assign(bytes, sizeof(T));
+		}
+
+		static T decode(const char *data, size_t size) {
+			detail::checkSize(size, sizeof(T));
+			bits raw = detail::loadLittleEndian<bits>(data);
+			T value;
+			std::memcpy(&value, &raw, sizeof(value));
+			return value;
+		}
+	};
+
+	template<class T>
+	struct ValueCodec<T, typename std::enable_if<std::is_trivially_copyable<T>::value && !detail::isPortableScalar<T>::value>::type> {
+		static void encode(const T& value, std::string& out) {
+			out.assign(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		static T decode(const char *data, size_t size) {
+			detail::checkSize(size, sizeof(T));
+			T value;
+			std::memcpy(&value, data, sizeof(T));
+			return value;
+		}
+	};
+
+	template<class T>
+	struct ValueCodec<std::vector<T>, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+		static void encode(const std::vector<T>& value, std::string& out) {
+			out.assign(reinterpret_cast<const char*>(value.data()), value.size() * sizeof(T));
+		}
+
+		static std::vector<T> decode(const char *data, size_t size) {
+			if(size % sizeof(T) != 0)
+				throw std::runtime_error("Stored value has " + std::to_string(size) + " bytes, not a multiple of " + std::to_string(sizeof(T)));
+			std::vector<T> value(size / sizeof(T));
+			if(size > 0) std::memcpy(value.data(), data, size);
+			return value;
+		}
+	};
+}
+
+#endif
@@ -61,7 +61,7 @@
 int __redisAppendCommand(redisContext *c, const char *cmd, size_t len);
 
 /* Functions managing dictionary of callbacks for pub/sub. */
-static unsigned int callbackHash(const void *key) {
+static uint64_t callbackHash(const void *key) {
     return dictGenHashFunction((const unsigned char *)key,
                                sdslen((const sds)key));
 }
@@ -130,10 +130,8 @@ static redisAsyncContext *redisAsyncInitialize(redisContext *c) {
     ac->onConnect = NULL;
     ac->onDisconnect = NULL;
 
-    ac->replies.head = NULL;
-    ac->replies.tail = NULL;
-    ac->sub.invalid.head = NULL;
-    ac->sub.invalid.tail = NULL;
+    memset(&ac->replies,0,sizeof(ac->replies));
+    memset(&ac->sub.invalid,0,sizeof(ac->sub.invalid));
     ac->sub.channels = dictCreate(&callbackDict,NULL);
     ac->sub.patterns = dictCreate(&callbackDict,NULL);
     return ac;
@@ -225,43 +223,56 @@ int redisAsyncSetDisconnectCallback(redisAsyncContext *ac, redisDisconnectCallba
 
 /* Helper functions to push/shift callbacks */
 static int __redisPushCallback(redisCallbackList *list, redisCallback *source) {
-    redisCallback *cb;
-
-    /* Copy callback from stack to heap */
-    cb = malloc(sizeof(*cb));
-    if (cb == NULL)
-        return REDIS_ERR_OOM;
-
-    if (source != NULL) {
-        memcpy(cb,source,sizeof(*cb));
-        cb->next = NULL;
+    redisCallback *slots;
+    size_t cap, first;
+
+    /* Grow the ring, unwrapping it so the oldest callback is in slot 0 */
+    if (list->count == list->cap) {
+        cap = list->cap ? list->cap*2 : REDIS_CALLBACK_SLOTS;
+        slots = malloc(cap*sizeof(*slots));
+        if (slots == NULL)
+            return REDIS_ERR_OOM;
+
+        first = list->cap-list->head;
+        if (first > list->count)
+            first = list->count;
+        if (list->count > 0) {
+            memcpy(slots,list->slots+list->head,first*sizeof(*slots));
+            memcpy(slots+first,list->slots,(list->count-first)*sizeof(*slots));
+        }
+        free(list->slots);
+        list->slots = slots;
+        list->head = 0;
+        list->cap = cap;
     }
 
-    /* Store callback in list */
-    if (list->head == NULL)
-        list->head = cb;
-    if (list->tail != NULL)
-        list->tail->next = cb;
-    list->tail = cb;
+    /* Copy callback from stack to its slot */
+    slots = list->slots+((list->head+list->count) & (list->cap-1));
+    if (source != NULL)
+        memcpy(slots,source,sizeof(*slots));
+    else
+        memset(slots,0,sizeof(*slots));
+    list->count++;
     return REDIS_OK;
 }
 
 static int __redisShiftCallback(redisCallbackList *list, redisCallback *target) {
-    redisCallback *cb = list->head;
-    if (cb != NULL) {
-        list->head = cb->next;
-        if (cb == list->tail)
-            list->tail = NULL;
-
-        /* Copy callback from heap to stack */
+    if (list->count > 0) {
+        /* Copy callback from its slot to stack */
         if (target != NULL)
-            memcpy(target,cb,sizeof(*cb));
-        free(cb);
+            memcpy(target,list->slots+list->head,sizeof(*target));
+        list->head = (list->head+1) & (list->cap-1);
+        list->count--;
         return REDIS_OK;
     }
     return REDIS_ERR;
 }
 
+static void __redisFreeCallbacks(redisCallbackList *list) {
+    free(list->slots);
+    memset(list,0,sizeof(*list));
+}
+
 static void __redisRunCallback(redisAsyncContext *ac, redisCallback *cb, redisReply *reply) {
     redisContext *c = &(ac->c);
     if (cb->fn != NULL) {
@@ -286,6 +297,9 @@ static void __redisAsyncFree(redisAsyncContext *ac) {
     while (__redisShiftCallback(&ac->sub.invalid,&cb) == REDIS_OK)
         __redisRunCallback(ac,&cb,NULL);
 
+    __redisFreeCallbacks(&ac->replies);
+    __redisFreeCallbacks(&ac->sub.invalid);
+
     /* Run subscription callbacks callbacks with NULL reply */
     it = dictGetIterator(ac->sub.channels);
     while ((de = dictNext(it)) != NULL)
@@ -357,7 +371,7 @@ static void __redisAsyncDisconnect(redisAsyncContext *ac) {
 void redisAsyncDisconnect(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
     c->flags |= REDIS_DISCONNECTING;
-    if (!(c->flags & REDIS_IN_CALLBACK) && ac->replies.head == NULL)
+    if (!(c->flags & REDIS_IN_CALLBACK) && ac->replies.count == 0)
         __redisAsyncDisconnect(ac);
 }
 
@@ -370,8 +384,8 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
     sds sname;
 
     /* Custom reply functions are not supported for pub/sub. This will fail
-     * very hard when they are used... */
-    if (reply->type == REDIS_REPLY_ARRAY) {
+     * very hard when they are used... RESP3 delivers these as pushes. */
+    if (reply->type == REDIS_REPLY_ARRAY || reply->type == REDIS_REPLY_PUSH) {
         assert(reply->elements >= 2);
         assert(reply->element[0]->type == REDIS_REPLY_STRING);
         stype = reply->element[0]->str;
@@ -394,9 +408,13 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
                 dictDelete(callbacks,sname);
 
                 /* If this was the last unsubscribe message, revert to
-                 * non-subscribe mode. */
+                 * non-subscribe mode. Subscriptions sent after the
+                 * unsubscribe are not counted by the server yet, but are
+                 * already in the dictionaries. */
                 assert(reply->element[2]->type == REDIS_REPLY_INTEGER);
-                if (reply->element[2]->integer == 0)
+                if (reply->element[2]->integer == 0 &&
+                    dictSize(ac->sub.channels) == 0 &&
+                    dictSize(ac->sub.patterns) == 0)
                     c->flags &= ~REDIS_SUBSCRIBED;
             }
         }
@@ -410,7 +428,7 @@ static int __redisGetSubscribeCallback(redisAsyncContext *ac, redisReply *reply,
 
 void redisProcessCallbacks(redisAsyncContext *ac) {
     redisContext *c = &(ac->c);
-    redisCallback cb = {NULL, NULL, NULL};
+    redisCallback cb = {NULL, NULL};
     void *reply = NULL;
     int status;
 
@@ -418,8 +436,8 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
         if (reply == NULL) {
             /* When the connection is being disconnected and there are
              * no more replies, this is the cue to really disconnect. */
-            if (c->flags & REDIS_DISCONNECTING && sdslen(c->obuf) == 0
-                && ac->replies.head == NULL) {
+            if (c->flags & REDIS_DISCONNECTING && c->obuflen == 0
+                && ac->replies.count == 0) {
                 __redisAsyncDisconnect(ac);
                 return;
             }
@@ -434,9 +452,19 @@ void redisProcessCallbacks(redisAsyncContext *ac) {
             break;
         }
 
+        /* RESP3 out-of-band data (pub/sub messages, client tracking
+         * invalidations) may arrive between regular replies, so it must
+         * never be matched against a pending command callback. */
+        if (((redisReply*)reply)->type == REDIS_REPLY_PUSH) {
+            redisReply *r = reply;
+            cb.fn = NULL;
+            if (c->flags & REDIS_SUBSCRIBED && r->elements >= 2 &&
+                r->element[1]->type == REDIS_REPLY_STRING)
+                __redisGetSubscribeCallback(ac,reply,&cb);
+        }
         /* Even if the context is subscribed, pending regular callbacks will
          * get a reply before pub/sub messages arrive. */
-        if (__redisShiftCallback(&ac->replies,&cb) != REDIS_OK) {
+        else if (__redisShiftCallback(&ac->replies,&cb) != REDIS_OK) {
             /*
              * A spontaneous reply in a not-subscribed context can be the error
              * reply that is sent when a new connection exceeds the maximum
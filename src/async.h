@@ -43,14 +43,21 @@ struct dict; /* dictionary header is included in async.c */
 /* Reply callback prototype and container */
 typedef void (redisCallbackFn)(struct redisAsyncContext*, void*, void*);
 typedef struct redisCallback {
-    struct redisCallback *next; /* simple singly linked list */
     redisCallbackFn *fn;
     void *privdata;
 } redisCallback;
 
-/* List of callbacks for either regular replies or pub/sub */
+/* Initial number of slots of a callback list, it doubles when full */
+#define REDIS_CALLBACK_SLOTS 16
+
+/* FIFO of callbacks for either regular replies or pub/sub. Callbacks are
+ * stored by value in a ring of slots, so queueing one doesn't allocate
+ * once the ring is large enough for the commands in flight. */
 typedef struct redisCallbackList {
-    redisCallback *head, *tail;
+    redisCallback *slots;
+    size_t head; /* slot of the oldest callback */
+    size_t count;
+    size_t cap; /* number of slots, a power of 2 */
 } redisCallbackList;
 
 /* Connection callback prototypes */
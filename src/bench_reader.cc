@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hiredis.h"
+
+/*
+ * Microbenchmark for the RESP reader: feeds synthetic corpora through
+ * redisReaderFeed()/redisReaderGetReply() in socket-sized chunks and reports
+ * ns/reply, bytes/s and allocations/reply.
+ *
+ * usage: bench_reader [-b hiredis|null] [-c chunk-bytes] [-t seconds] [corpus...]
+ */
+
+/* allocation counting, glibc only: the program's malloc family shadows the
+ * one in libc and forwards to it */
+static bool countAllocs = false;
+static size_t allocs = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t n, size_t size);
+	void *__libc_realloc(void *ptr, size_t size);
+	void __libc_free(void *ptr);
+
+	void *malloc(size_t size) { if(countAllocs) allocs++; return __libc_malloc(size); }
+	void *calloc(size_t n, size_t size) { if(countAllocs) allocs++; return __libc_calloc(n, size); }
+	void *realloc(void *ptr, size_t size) { if(countAllocs) allocs++; return __libc_realloc(ptr, size); }
+	void free(void *ptr) { __libc_free(ptr); }
+}
+#define HAVE_ALLOC_COUNT 1
+#endif
+
+struct Corpus {
+	std::string name;
+	std::string data;
+	size_t replies;
+};
+
+static std::string bulk(const std::string& s) {
+	return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+static std::string nested(int depth) {
+	if(depth == 0) return ":42\r\n";
+	std::string inner = nested(depth - 1);
+	return "*3\r\n" + inner + bulk("leaf") + inner;
+}
+
+static std::vector<Corpus> makeCorpora() {
+	std::vector<Corpus> corpora;
+	Corpus c;
+
+	c = Corpus{"status", "", 100000};
+	for(size_t i=0; i<c.replies; i++) c.data += "+OK\r\n";
+	corpora.push_back(c);
+
+	c = Corpus{"integers", "", 100000};
+	for(size_t i=0; i<c.replies; i++) c.data += ":" + std::to_string(i * 7919) + "\r\n";
+	corpora.push_back(c);
+
+	c = Corpus{"bulk-1m", "", 16};
+	for(size_t i=0; i<c.replies; i++) c.data += bulk(std::string(1024 * 1024, 'a' + i % 26));
+	corpora.push_back(c);
+
+	c = Corpus{"array-1k", "", 200};
+	for(size_t i=0; i<c.replies; i++) {
+		c.data += "*1000\r\n";
+		for(size_t j=0; j<1000; j++) c.data += bulk("member" + std::to_string(j));
+	}
+	corpora.push_back(c);
+
+	c = Corpus{"nested", "", 1000};
+	std::string tree = nested(6);
+	for(size_t i=0; i<c.replies; i++) c.data += tree;
+	corpora.push_back(c);
+
+	return corpora;
+}
+
+/* feed the corpus once in chunks of chunk bytes, returns replies parsed */
+static size_t runOnce(const Corpus& corpus, bool nullBuilders, size_t chunk) {
+	redisReader *reader = nullBuilders ? redisReaderCreateWithFunctions(NULL) : redisReaderCreate();
+	size_t replies = 0;
+
+	for(size_t off=0; off<corpus.data.size(); off+=chunk) {
+		size_t len = std::min(chunk, corpus.data.size() - off);
+		if(redisReaderFeed(reader, corpus.data.data() + off, len) != REDIS_OK) break;
+
+		void *reply;
+		while(redisReaderGetReply(reader, &reply) == REDIS_OK && reply != NULL) {
+			if(!nullBuilders) freeReplyObject(reply);
+			replies++;
+		}
+		if(reader->err) {
+			std::cerr<<corpus.name<<": "<<reader->errstr<<std::endl;
+			break;
+		}
+	}
+
+	redisReaderFree(reader);
+	return replies;
+}
+
+int main(int argc, char* argv[]) {
+	bool nullBuilders = false;
+	size_t chunk = 16 * 1024;
+	double seconds = 1.0;
+	std::vector<std::string> selected;
+
+	for(int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "-b" && i + 1 < argc) {
+			std::string builder = argv[++i];
+			if(builder != "hiredis" && builder != "null") {
+				std::cerr<<"unknown builder "<<builder<<std::endl;
+				return 1;
+			}
+			nullBuilders = builder == "null";
+		}
+		else if(arg == "-c" && i + 1 < argc) chunk = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+		else if(arg == "-t" && i + 1 < argc) seconds = std::atof(argv[++i]);
+		else if(arg[0] == '-') {
+			std::cerr<<"usage: "<<argv[0]<<" [-b hiredis|null] [-c chunk-bytes] [-t seconds] [corpus...]"<<std::endl;
+			return 1;
+		}
+		else selected.push_back(arg);
+	}
+
+	std::printf("builder %s, chunk %zu bytes\n", nullBuilders ? "null" : "hiredis", chunk);
+	std::printf("%-10s %12s %12s %14s %14s\n", "corpus", "bytes", "ns/reply", "MB/s", "allocs/reply");
+
+	for(const auto& corpus : makeCorpora()) {
+		if(!selected.empty() && std::find(selected.begin(), selected.end(), corpus.name) == selected.end())
+			continue;
+
+		/* warm-up pass, also checks the corpus parses completely */
+		if(runOnce(corpus, nullBuilders, chunk) != corpus.replies) {
+			std::cerr<<corpus.name<<": reply count mismatch"<<std::endl;
+			return 1;
+		}
+
+		size_t iterations = 0, replies = 0;
+		allocs = 0;
+		countAllocs = true;
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::duration<double> elapsed;
+		do {
+			replies += runOnce(corpus, nullBuilders, chunk);
+			iterations++;
+			elapsed = std::chrono::steady_clock::now() - start;
+		} while(elapsed.count() < seconds);
+		countAllocs = false;
+
+		double bytes = (double)corpus.data.size() * iterations;
+		std::printf("%-10s %12zu %12.1f %14.1f ", corpus.name.c_str(), corpus.data.size(),
+				elapsed.count() * 1e9 / replies, bytes / elapsed.count() / 1e6);
+#ifdef HAVE_ALLOC_COUNT
+		std::printf("%14.2f\n", (double)allocs / replies);
+#else
+		std::printf("%14s\n", "n/a");
+#endif
+	}
+
+	return 0;
+}
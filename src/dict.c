@@ -3,7 +3,8 @@
  * This file implements in memory hash tables with insert/del/replace/find/
  * get-random-element operations. Hash tables will auto resize if needed
  * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * open addressing with linear probing, and growing the table rehashes
+ * incrementally. See the source code for more information... :)
  *
  * Copyright (c) 2006-2010, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -35,6 +36,7 @@
 
 #include "fmacros.h"
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <limits.h>
 #include "dict.h"
@@ -43,113 +45,176 @@
 
 static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
-static int _dictKeyIndex(dict *ht, const void *key);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
+static void _dictRehashStep(dict *ht, int all);
+static long _dictSlotFind(dict *d, dictht *t, const void *key, uint64_t hash);
+static dictEntry *_dictSlotInsert(dictht *t, uint64_t hash);
+static void _dictSlotDelete(dictht *t, unsigned long idx);
 
 /* -------------------------- hash functions -------------------------------- */
 
-/* Generic hash function (a popular one from Bernstein).
- * I tested a few and this was the best. */
-static unsigned int dictGenHashFunction(const unsigned char *buf, int len) {
-    unsigned int hash = 5381;
+/* MurmurHash64A by Austin Appleby: a 64 bit hash that mixes 8 bytes per
+ * round and spreads short keys well over the low bits used as index. */
+static uint64_t dictGenHashFunction(const unsigned char *buf, int len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0x9747b28cULL ^ ((uint64_t)len * m);
+    const unsigned char *end = buf + (len & ~7);
+    uint64_t k;
+
+    while (buf != end) {
+        memcpy(&k,buf,sizeof(k));
+        buf += 8;
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+    case 7: h ^= (uint64_t)buf[6] << 48; /* fall through */
+    case 6: h ^= (uint64_t)buf[5] << 40; /* fall through */
+    case 5: h ^= (uint64_t)buf[4] << 32; /* fall through */
+    case 4: h ^= (uint64_t)buf[3] << 24; /* fall through */
+    case 3: h ^= (uint64_t)buf[2] << 16; /* fall through */
+    case 2: h ^= (uint64_t)buf[1] << 8; /* fall through */
+    case 1: h ^= (uint64_t)buf[0];
+            h *= m;
+    }
 
-    while (len--)
-        hash = ((hash << 5) + hash) + (*buf++); /* hash * 33 + c */
-    return hash;
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
 }
 
 /* ----------------------------- API implementation ------------------------- */
 
-/* Reset an hashtable already initialized with ht_init().
- * NOTE: This function should only called by ht_destroy(). */
-static void _dictReset(dict *ht) {
-    ht->table = NULL;
-    ht->size = 0;
-    ht->sizemask = 0;
-    ht->used = 0;
+/* Reset a hash table of the dictionary, without freeing it. */
+static void _dictReset(dictht *t) {
+    t->table = NULL;
+    t->size = 0;
+    t->sizemask = 0;
+    t->used = 0;
 }
 
 /* Create a new hash table */
 static dict *dictCreate(dictType *type, void *privDataPtr) {
     dict *ht = malloc(sizeof(*ht));
+    if (ht == NULL)
+        return NULL;
     _dictInit(ht,type,privDataPtr);
     return ht;
 }
 
 /* Initialize the hash table */
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr) {
-    _dictReset(ht);
+    _dictReset(&ht->ht[0]);
+    _dictReset(&ht->ht[1]);
     ht->type = type;
     ht->privdata = privDataPtr;
+    ht->rehashidx = -1;
+    ht->rehashleft = 0;
+    ht->iterators = 0;
     return DICT_OK;
 }
 
-/* Expand or create the hashtable */
+/* Expand or create the hashtable. Entries are moved to the new table
+ * incrementally by the following operations. */
 static int dictExpand(dict *ht, unsigned long size) {
-    dict n; /* the new hashtable */
+    dictht n; /* the new hashtable */
     unsigned long realsize = _dictNextPower(size), i;
 
     /* the size is invalid if it is smaller than the number of
      * elements already inside the hashtable */
-    if (ht->used > size)
+    if (dictSize(ht) >= size)
         return DICT_ERR;
 
-    _dictInit(&n, ht->type, ht->privdata);
+    /* Only one rehash at a time */
+    if (dictIsRehashing(ht))
+        _dictRehashStep(ht,1);
+
     n.size = realsize;
     n.sizemask = realsize-1;
-    n.table = calloc(realsize,sizeof(dictEntry*));
-
-    /* Copy all the elements from the old to the new table:
-     * note that if the old hash table is empty ht->size is zero,
-     * so dictExpand just creates an hash table. */
-    n.used = ht->used;
-    for (i = 0; i < ht->size && ht->used > 0; i++) {
-        dictEntry *he, *nextHe;
-
-        if (ht->table[i] == NULL) continue;
-
-        /* For each hash entry on this slot... */
-        he = ht->table[i];
-        while(he) {
-            unsigned int h;
-
-            nextHe = he->next;
-            /* Get the new element index */
-            h = dictHashKey(ht, he->key) & n.sizemask;
-            he->next = n.table[h];
-            n.table[h] = he;
-            ht->used--;
-            /* Pass to the next element */
-            he = nextHe;
-        }
+    n.used = 0;
+    n.table = calloc(realsize,sizeof(dictEntry));
+    if (n.table == NULL)
+        return DICT_ERR;
+
+    /* Nothing to move if the old hash table is empty */
+    if (ht->ht[0].used == 0) {
+        free(ht->ht[0].table);
+        ht->ht[0] = n;
+        return DICT_OK;
     }
-    assert(ht->used == 0);
-    free(ht->table);
 
-    /* Remap the new hashtable in the old */
-    *ht = n;
+    /* Start on a free slot: probe sequences never wrap past it, so every
+     * step can move whole runs of entries. There is one as the load factor
+     * is kept below 1. */
+    for (i = 0; ht->ht[0].table[i].key != NULL; i++);
+    ht->ht[1] = n;
+    ht->rehashidx = i;
+    ht->rehashleft = ht->ht[0].size;
     return DICT_OK;
 }
 
+/* Move the next DICT_REHASH_SLOTS slots of ht[0], or all of them, to ht[1].
+ * A step never stops in the middle of a run of entries: one moved half way
+ * would break the probe sequences of the entries behind it. */
+static void _dictRehashStep(dict *ht, int all) {
+    dictht *from = &ht->ht[0];
+    unsigned long n = DICT_REHASH_SLOTS;
+    dictEntry *src, *dst;
+
+    if (!dictIsRehashing(ht) || (ht->iterators > 0 && !all))
+        return;
+
+    while (ht->rehashleft > 0) {
+        src = &from->table[ht->rehashidx];
+        if (src->key == NULL && n == 0 && !all)
+            break;
+
+        if (src->key != NULL) {
+            dst = _dictSlotInsert(&ht->ht[1],src->hash);
+            *dst = *src;
+            src->key = NULL;
+            from->used--;
+        }
+        ht->rehashidx = (ht->rehashidx+1) & from->sizemask;
+        ht->rehashleft--;
+        if (n > 0) n--;
+    }
+
+    if (ht->rehashleft == 0) {
+        assert(from->used == 0);
+        free(from->table);
+        ht->ht[0] = ht->ht[1];
+        _dictReset(&ht->ht[1]);
+        ht->rehashidx = -1;
+    }
+}
+
 /* Add an element to the target hash table */
 static int dictAdd(dict *ht, void *key, void *val) {
-    int index;
+    uint64_t hash;
     dictEntry *entry;
 
-    /* Get the index of the new element, or -1 if
-     * the element already exists. */
-    if ((index = _dictKeyIndex(ht, key)) == -1)
+    _dictRehashStep(ht,0);
+
+    /* Fail if the element already exists. */
+    if (dictFind(ht,key) != NULL)
+        return DICT_ERR;
+    if (_dictExpandIfNeeded(ht) == DICT_ERR)
         return DICT_ERR;
 
-    /* Allocates the memory and stores key */
-    entry = malloc(sizeof(*entry));
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
+    /* New elements always go to the table being rehashed into */
+    hash = dictHashKey(ht, key);
+    entry = _dictSlotInsert(&ht->ht[dictIsRehashing(ht) ? 1 : 0],hash);
 
     /* Set the hash entry fields. */
     dictSetHashKey(ht, entry, key);
     dictSetHashVal(ht, entry, val);
-    ht->used++;
     return DICT_OK;
 }
 
@@ -166,7 +231,8 @@ static int dictReplace(dict *ht, void *key, void *val) {
         return 1;
     /* It already exists, get the entry */
     entry = dictFind(ht, key);
-    /* Free the old value and set the new one */
+    if (entry == NULL)
+        return 0; /* out of memory */
     /* Set the new value and free the old one. Note that it is important
      * to do that in this order, as the value may just be exactly the same
      * as the previous one. In this context, think to reference counting,
@@ -180,31 +246,25 @@ static int dictReplace(dict *ht, void *key, void *val) {
 
 /* Search and remove an element */
 static int dictDelete(dict *ht, const void *key) {
-    unsigned int h;
-    dictEntry *de, *prevde;
+    uint64_t hash;
+    dictEntry *de;
+    long idx;
+    int i;
 
-    if (ht->size == 0)
+    _dictRehashStep(ht,0);
+    if (dictSize(ht) == 0)
         return DICT_ERR;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    de = ht->table[h];
-
-    prevde = NULL;
-    while(de) {
-        if (dictCompareHashKeys(ht,key,de->key)) {
-            /* Unlink the element from the list */
-            if (prevde)
-                prevde->next = de->next;
-            else
-                ht->table[h] = de->next;
-
-            dictFreeEntryKey(ht,de);
-            dictFreeEntryVal(ht,de);
-            free(de);
-            ht->used--;
-            return DICT_OK;
-        }
-        prevde = de;
-        de = de->next;
+
+    hash = dictHashKey(ht, key);
+    for (i = 0; i <= 1; i++) {
+        if ((idx = _dictSlotFind(ht,&ht->ht[i],key,hash)) == -1)
+            continue;
+
+        de = &ht->ht[i].table[idx];
+        dictFreeEntryKey(ht,de);
+        dictFreeEntryVal(ht,de);
+        _dictSlotDelete(&ht->ht[i],idx);
+        return DICT_OK;
     }
     return DICT_ERR; /* not found */
 }
@@ -212,25 +272,24 @@ static int dictDelete(dict *ht, const void *key) {
 /* Destroy an entire hash table */
 static int _dictClear(dict *ht) {
     unsigned long i;
+    int t;
 
     /* Free all the elements */
-    for (i = 0; i < ht->size && ht->used > 0; i++) {
-        dictEntry *he, *nextHe;
+    for (t = 0; t <= 1; t++) {
+        dictht *tab = &ht->ht[t];
+        for (i = 0; i < tab->size && tab->used > 0; i++) {
+            dictEntry *he = &tab->table[i];
 
-        if ((he = ht->table[i]) == NULL) continue;
-        while(he) {
-            nextHe = he->next;
+            if (he->key == NULL) continue;
             dictFreeEntryKey(ht, he);
             dictFreeEntryVal(ht, he);
-            free(he);
-            ht->used--;
-            he = nextHe;
+            tab->used--;
         }
+        /* Free the table and the allocated cache structure */
+        free(tab->table);
     }
-    /* Free the table and the allocated cache structure */
-    free(ht->table);
     /* Re-initialize the table */
-    _dictReset(ht);
+    _dictInit(ht,ht->type,ht->privdata);
     return DICT_OK; /* never fails */
 }
 
@@ -241,51 +300,51 @@ static void dictRelease(dict *ht) {
 }
 
 static dictEntry *dictFind(dict *ht, const void *key) {
-    dictEntry *he;
-    unsigned int h;
-
-    if (ht->size == 0) return NULL;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return he;
-        he = he->next;
+    uint64_t hash;
+    long idx;
+    int i;
+
+    _dictRehashStep(ht,0);
+    if (dictSize(ht) == 0) return NULL;
+
+    hash = dictHashKey(ht, key);
+    for (i = 0; i <= 1; i++) {
+        if ((idx = _dictSlotFind(ht,&ht->ht[i],key,hash)) != -1)
+            return &ht->ht[i].table[idx];
     }
     return NULL;
 }
 
 static dictIterator *dictGetIterator(dict *ht) {
     dictIterator *iter = malloc(sizeof(*iter));
+    if (iter == NULL)
+        return NULL;
 
     iter->ht = ht;
-    iter->index = -1;
-    iter->entry = NULL;
-    iter->nextEntry = NULL;
+    iter->table = 0;
+    iter->index = 0;
+    ht->iterators++;
     return iter;
 }
 
 static dictEntry *dictNext(dictIterator *iter) {
-    while (1) {
-        if (iter->entry == NULL) {
-            iter->index++;
-            if (iter->index >=
-                    (signed)iter->ht->size) break;
-            iter->entry = iter->ht->table[iter->index];
-        } else {
-            iter->entry = iter->nextEntry;
-        }
-        if (iter->entry) {
-            /* We need to save the 'next' here, the iterator user
-             * may delete the entry we are returning. */
-            iter->nextEntry = iter->entry->next;
-            return iter->entry;
+    dictht *t;
+
+    while (iter->table <= 1) {
+        t = &iter->ht->ht[iter->table];
+        while (iter->index < t->size) {
+            dictEntry *he = &t->table[iter->index++];
+            if (he->key != NULL)
+                return he;
         }
+        iter->table++;
+        iter->index = 0;
     }
     return NULL;
 }
 
 static void dictReleaseIterator(dictIterator *iter) {
+    iter->ht->iterators--;
     free(iter);
 }
 
@@ -293,13 +352,16 @@ static void dictReleaseIterator(dictIterator *iter) {
 
 /* Expand the hash table if needed */
 static int _dictExpandIfNeeded(dict *ht) {
-    /* If the hash table is empty expand it to the intial size,
-     * if the table is "full" dobule its size. */
-    if (ht->size == 0)
+    dictht *t = &ht->ht[dictIsRehashing(ht) ? 1 : 0];
+
+    /* If the hash table is empty expand it to the intial size. Linear
+     * probing degrades quickly as the table fills up, so the size doubles
+     * once it is 3/4 full. */
+    if (t->size == 0)
         return dictExpand(ht, DICT_HT_INITIAL_SIZE);
-    if (ht->used == ht->size)
-        return dictExpand(ht, ht->size*2);
-    return DICT_OK;
+    if ((dictSize(ht)+1)*4 <= t->size*3)
+        return DICT_OK;
+    return dictExpand(ht, t->size*2);
 }
 
 /* Our hash table capability is a power of two */
@@ -314,25 +376,51 @@ static unsigned long _dictNextPower(unsigned long size) {
     }
 }
 
-/* Returns the index of a free slot that can be populated with
- * an hash entry for the given 'key'.
- * If the key already exists, -1 is returned. */
-static int _dictKeyIndex(dict *ht, const void *key) {
-    unsigned int h;
+/* Returns the slot of 'key' in table t, or -1 if it is not there. */
+static long _dictSlotFind(dict *d, dictht *t, const void *key, uint64_t hash) {
+    unsigned long idx;
     dictEntry *he;
 
-    /* Expand the hashtable if needed */
-    if (_dictExpandIfNeeded(ht) == DICT_ERR)
+    if (t->used == 0)
         return -1;
-    /* Compute the key hash value */
-    h = dictHashKey(ht, key) & ht->sizemask;
-    /* Search if this slot does not already contain the given key */
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
+    for (idx = hash & t->sizemask; ; idx = (idx+1) & t->sizemask) {
+        he = &t->table[idx];
+        if (he->key == NULL)
             return -1;
-        he = he->next;
+        if (he->hash == hash && dictCompareHashKeys(d, key, he->key))
+            return idx;
     }
-    return h;
 }
 
+/* Returns the first free slot on the probe sequence of 'hash', claimed for
+ * the caller to fill in. The table must not be full. */
+static dictEntry *_dictSlotInsert(dictht *t, uint64_t hash) {
+    unsigned long idx = hash & t->sizemask;
+
+    while (t->table[idx].key != NULL)
+        idx = (idx+1) & t->sizemask;
+    t->table[idx].hash = hash;
+    t->used++;
+    return &t->table[idx];
+}
+
+/* Free slot idx, moving back the entries after it that would otherwise
+ * become unreachable, so that no tombstones are needed. */
+static void _dictSlotDelete(dictht *t, unsigned long idx) {
+    unsigned long next, home;
+
+    for (next = (idx+1) & t->sizemask; t->table[next].key != NULL;
+         next = (next+1) & t->sizemask)
+    {
+        /* An entry may fill the hole unless its home slot lies cyclically
+         * after the hole and at or before its current slot. */
+        home = t->table[next].hash & t->sizemask;
+        if (idx <= next ? (home > idx && home <= next)
+                        : (home > idx || home <= next))
+            continue;
+        t->table[idx] = t->table[next];
+        idx = next;
+    }
+    t->table[idx].key = NULL;
+    t->used--;
+}
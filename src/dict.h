@@ -3,7 +3,8 @@
  * This file implements in memory hash tables with insert/del/replace/find/
  * get-random-element operations. Hash tables will auto resize if needed
  * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * open addressing with linear probing, and growing the table rehashes
+ * incrementally. See the source code for more information... :)
  *
  * Copyright (c) 2006-2010, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -36,20 +37,25 @@
 #ifndef __DICT_H
 #define __DICT_H
 
+#include <stdint.h>
+
 #define DICT_OK 0
 #define DICT_ERR 1
 
 /* Unused arguments generate annoying warnings... */
 #define DICT_NOTUSED(V) ((void) V)
 
+/* Entries live in the table itself, a NULL key marks a free slot, so NULL
+ * keys are not supported. Pointers to entries are invalidated by any call
+ * that modifies or looks up the dictionary. */
 typedef struct dictEntry {
     void *key;
     void *val;
-    struct dictEntry *next;
+    uint64_t hash;
 } dictEntry;
 
 typedef struct dictType {
-    unsigned int (*hashFunction)(const void *key);
+    uint64_t (*hashFunction)(const void *key);
     void *(*keyDup)(void *privdata, const void *key);
     void *(*valDup)(void *privdata, const void *obj);
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);
@@ -57,24 +63,38 @@ typedef struct dictType {
     void (*valDestructor)(void *privdata, void *obj);
 } dictType;
 
-typedef struct dict {
-    dictEntry **table;
-    dictType *type;
+typedef struct dictht {
+    dictEntry *table;
     unsigned long size;
     unsigned long sizemask;
     unsigned long used;
+} dictht;
+
+/* While growing, entries move from ht[0] to ht[1] a few slots at a time
+ * on every operation, new entries go straight to ht[1]. */
+typedef struct dict {
+    dictht ht[2];
+    dictType *type;
     void *privdata;
+    long rehashidx; /* next slot of ht[0] to move, -1 if not rehashing */
+    unsigned long rehashleft; /* slots of ht[0] not visited yet */
+    int iterators; /* rehashing is paused while iterators exist */
 } dict;
 
+/* The dictionary must not be modified while an iterator exists. */
 typedef struct dictIterator {
     dict *ht;
-    int index;
-    dictEntry *entry, *nextEntry;
+    int table;
+    unsigned long index;
 } dictIterator;
 
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Slots of ht[0] moved per operation while rehashing. A step always ends on
+ * a free slot, so a run of entries that probe into each other moves at once. */
+#define DICT_REHASH_SLOTS        8
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeEntryVal(ht, entry) \
     if ((ht)->type->valDestructor) \
@@ -107,11 +127,12 @@ typedef struct dictIterator {
 
 #define dictGetEntryKey(he) ((he)->key)
 #define dictGetEntryVal(he) ((he)->val)
-#define dictSlots(ht) ((ht)->size)
-#define dictSize(ht) ((ht)->used)
+#define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
+#define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
+#define dictIsRehashing(d) ((d)->rehashidx != -1)
 
 /* API */
-static unsigned int dictGenHashFunction(const unsigned char *buf, int len);
+static uint64_t dictGenHashFunction(const unsigned char *buf, int len);
 static dict *dictCreate(dictType *type, void *privDataPtr);
 static int dictExpand(dict *ht, unsigned long size);
 static int dictAdd(dict *ht, void *key, void *val);
@@ -38,16 +38,23 @@
 #include <assert.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <time.h>
 
 #include "hiredis.h"
 #include "net.h"
 #include "sds.h"
 
 static redisReply *createReplyObject(int type);
+static void __redisOutputFree(redisContext *c);
 static void *createStringObject(const redisReadTask *task, char *str, size_t len);
+static void *createStringObjectNoCopy(const redisReadTask *task, char *str, size_t len);
 static void *createArrayObject(const redisReadTask *task, int elements);
 static void *createIntegerObject(const redisReadTask *task, long long value);
 static void *createNilObject(const redisReadTask *task);
+static void *createDoubleObject(const redisReadTask *task, double value, char *str, size_t len);
+static void *createBoolObject(const redisReadTask *task, int bval);
 
 /* Default set of functions to build the reply. Keep in mind that such a
  * function returning NULL is interpreted as OOM. */
@@ -56,7 +63,10 @@ static redisReplyObjectFunctions defaultFunctions = {
     createArrayObject,
     createIntegerObject,
     createNilObject,
-    freeReplyObject
+    freeReplyObject,
+    createDoubleObject,
+    createBoolObject,
+    createStringObjectNoCopy
 };
 
 /* Create a reply object */
@@ -80,8 +90,14 @@ void freeReplyObject(void *reply) {
 
     switch(r->type) {
     case REDIS_REPLY_INTEGER:
+    case REDIS_REPLY_NIL:
+    case REDIS_REPLY_BOOL:
         break; /* Nothing to free */
     case REDIS_REPLY_ARRAY:
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_ATTR:
+    case REDIS_REPLY_PUSH:
         if (r->element != NULL) {
             for (j = 0; j < r->elements; j++)
                 if (r->element[j] != NULL)
@@ -92,6 +108,9 @@ void freeReplyObject(void *reply) {
     case REDIS_REPLY_ERROR:
     case REDIS_REPLY_STATUS:
     case REDIS_REPLY_STRING:
+    case REDIS_REPLY_DOUBLE:
+    case REDIS_REPLY_BIGNUM:
+    case REDIS_REPLY_VERB:
         if (r->str != NULL)
             free(r->str);
         break;
@@ -99,45 +118,91 @@ void freeReplyObject(void *reply) {
     free(r);
 }
 
+/* Link a new object into its parent aggregate, if any. */
+static void attachToParent(const redisReadTask *task, redisReply *r) {
+    redisReply *parent;
+
+    if (task->parent) {
+        parent = task->parent->obj;
+        assert(REDIS_REPLY_IS_AGGREGATE(parent->type));
+        parent->element[task->idx] = r;
+    }
+}
+
 static void *createStringObject(const redisReadTask *task, char *str, size_t len) {
-    redisReply *r, *parent;
+    redisReply *r;
     char *buf;
 
     r = createReplyObject(task->type);
     if (r == NULL)
         return NULL;
 
+    assert(task->type == REDIS_REPLY_ERROR  ||
+           task->type == REDIS_REPLY_STATUS ||
+           task->type == REDIS_REPLY_STRING ||
+           task->type == REDIS_REPLY_BIGNUM ||
+           task->type == REDIS_REPLY_VERB);
+
+    /* Verbatim strings keep their format ("txt", "mkd") apart from the
+     * payload; the reader made sure the prefix is there. */
+    if (task->type == REDIS_REPLY_VERB) {
+        memcpy(r->vtype,str,3);
+        r->vtype[3] = '\0';
+        str += 4;
+        len -= 4;
+    }
+
     buf = malloc(len+1);
     if (buf == NULL) {
         freeReplyObject(r);
         return NULL;
     }
 
-    assert(task->type == REDIS_REPLY_ERROR  ||
-           task->type == REDIS_REPLY_STATUS ||
-           task->type == REDIS_REPLY_STRING);
-
     /* Copy string value */
     memcpy(buf,str,len);
     buf[len] = '\0';
     r->str = buf;
     r->len = len;
 
-    if (task->parent) {
-        parent = task->parent->obj;
-        assert(parent->type == REDIS_REPLY_ARRAY);
-        parent->element[task->idx] = r;
+    attachToParent(task,r);
+    return r;
+}
+
+/* Same as createStringObject, but adopts the reader-allocated buffer. */
+static void *createStringObjectNoCopy(const redisReadTask *task, char *str, size_t len) {
+    redisReply *r;
+
+    r = createReplyObject(task->type);
+    if (r == NULL)
+        return NULL;
+
+    assert(task->type == REDIS_REPLY_ERROR ||
+           task->type == REDIS_REPLY_STRING ||
+           task->type == REDIS_REPLY_VERB);
+
+    if (task->type == REDIS_REPLY_VERB) {
+        memcpy(r->vtype,str,3);
+        r->vtype[3] = '\0';
+        memmove(str,str+4,len-4+1);
+        len -= 4;
     }
+
+    r->str = str;
+    r->len = len;
+
+    attachToParent(task,r);
     return r;
 }
 
 static void *createArrayObject(const redisReadTask *task, int elements) {
-    redisReply *r, *parent;
+    redisReply *r;
 
-    r = createReplyObject(REDIS_REPLY_ARRAY);
+    r = createReplyObject(task->type);
     if (r == NULL)
         return NULL;
 
+    assert(REDIS_REPLY_IS_AGGREGATE(task->type));
+
     if (elements > 0) {
         r->element = calloc(elements,sizeof(redisReply*));
         if (r->element == NULL) {
@@ -148,16 +213,12 @@ static void *createArrayObject(const redisReadTask *task, int elements) {
 
     r->elements = elements;
 
-    if (task->parent) {
-        parent = task->parent->obj;
-        assert(parent->type == REDIS_REPLY_ARRAY);
-        parent->element[task->idx] = r;
-    }
+    attachToParent(task,r);
     return r;
 }
 
 static void *createIntegerObject(const redisReadTask *task, long long value) {
-    redisReply *r, *parent;
+    redisReply *r;
 
     r = createReplyObject(REDIS_REPLY_INTEGER);
     if (r == NULL)
@@ -165,26 +226,54 @@ static void *createIntegerObject(const redisReadTask *task, long long value) {
 
     r->integer = value;
 
-    if (task->parent) {
-        parent = task->parent->obj;
-        assert(parent->type == REDIS_REPLY_ARRAY);
-        parent->element[task->idx] = r;
+    attachToParent(task,r);
+    return r;
+}
+
+static void *createDoubleObject(const redisReadTask *task, double value, char *str, size_t len) {
+    redisReply *r;
+
+    r = createReplyObject(REDIS_REPLY_DOUBLE);
+    if (r == NULL)
+        return NULL;
+
+    r->dval = value;
+
+    /* Keep the textual form as well, it is exact where the double is not. */
+    r->str = malloc(len+1);
+    if (r->str == NULL) {
+        freeReplyObject(r);
+        return NULL;
     }
+    memcpy(r->str,str,len);
+    r->str[len] = '\0';
+    r->len = len;
+
+    attachToParent(task,r);
+    return r;
+}
+
+static void *createBoolObject(const redisReadTask *task, int bval) {
+    redisReply *r;
+
+    r = createReplyObject(REDIS_REPLY_BOOL);
+    if (r == NULL)
+        return NULL;
+
+    r->integer = bval != 0;
+
+    attachToParent(task,r);
     return r;
 }
 
 static void *createNilObject(const redisReadTask *task) {
-    redisReply *r, *parent;
+    redisReply *r;
 
     r = createReplyObject(REDIS_REPLY_NIL);
     if (r == NULL)
         return NULL;
 
-    if (task->parent) {
-        parent = task->parent->obj;
-        assert(parent->type == REDIS_REPLY_ARRAY);
-        parent->element[task->idx] = r;
-    }
+    attachToParent(task,r);
     return r;
 }
 
@@ -598,14 +687,14 @@ static redisContext *redisContextInit(void) {
 
     c->err = 0;
     c->errstr[0] = '\0';
-    c->obuf = sdsempty();
     c->reader = redisReaderCreate();
     c->tcp.host = NULL;
     c->tcp.source_addr = NULL;
     c->unix_sock.path = NULL;
     c->timeout = NULL;
+    c->sockopt.nodelay = 1;
 
-    if (c->obuf == NULL || c->reader == NULL) {
+    if (c->reader == NULL) {
         redisFree(c);
         return NULL;
     }
@@ -618,10 +707,10 @@ void redisFree(redisContext *c) {
         return;
     if (c->fd > 0)
         close(c->fd);
-    if (c->obuf != NULL)
-        sdsfree(c->obuf);
+    __redisOutputFree(c);
     if (c->reader != NULL)
         redisReaderFree(c->reader);
+    redisContextFreeAddrCache(c);
     if (c->tcp.host)
         free(c->tcp.host);
     if (c->tcp.source_addr)
@@ -648,17 +737,20 @@ int redisReconnect(redisContext *c) {
         close(c->fd);
     }
 
-    sdsfree(c->obuf);
+    __redisOutputFree(c);
     redisReaderFree(c->reader);
 
-    c->obuf = sdsempty();
     c->reader = redisReaderCreate();
 
     if (c->connection_type == REDIS_CONN_TCP) {
-        return redisContextConnectBindTcp(c, c->tcp.host, c->tcp.port,
-                c->timeout, c->tcp.source_addr);
+        if (redisContextConnectBindTcp(c, c->tcp.host, c->tcp.port,
+                c->timeout, c->tcp.source_addr) != REDIS_OK)
+            return REDIS_ERR;
+        return redisContextRestoreSocketOptions(c);
     } else if (c->connection_type == REDIS_CONN_UNIX) {
-        return redisContextConnectUnix(c, c->unix_sock.path, c->timeout);
+        if (redisContextConnectUnix(c, c->unix_sock.path, c->timeout) != REDIS_OK)
+            return REDIS_ERR;
+        return redisContextRestoreSocketOptions(c);
     } else {
         /* Something bad happened here and shouldn't have. There isn't
            enough information in the context to reconnect. */
@@ -779,6 +871,13 @@ int redisSetTimeout(redisContext *c, const struct timeval tv) {
     return REDIS_ERR;
 }
 
+int redisSetSpinWait(redisContext *c, int usec) {
+    if (!(c->flags & REDIS_BLOCK) || usec < 0)
+        return REDIS_ERR;
+    c->spinwait = usec;
+    return REDIS_OK;
+}
+
 /* Enable connection KeepAlive. */
 int redisEnableKeepAlive(redisContext *c) {
     if (redisKeepAlive(c, REDIS_KEEPALIVE_INTERVAL) != REDIS_OK)
@@ -791,15 +890,51 @@ int redisEnableKeepAlive(redisContext *c) {
  *
  * After this function is called, you may use redisContextReadReply to
  * see if there is a reply available. */
+/* Adapt the socket read size to the incoming traffic: a read that fills
+ * the whole window doubles it, up to REDIS_READER_MAX_READ, so large
+ * replies take few syscalls. Once a read comes back smaller than maxbuf
+ * the window drops back to its initial size, which in turn lets the reader
+ * release its buffer. */
+static void __redisAdaptReadSize(redisReader *r, size_t requested, size_t nread) {
+    if (nread == requested) {
+        if (r->readlen < REDIS_READER_MAX_READ)
+            r->readlen *= 2;
+    } else if (r->maxbuf != 0 && nread < r->maxbuf) {
+        r->readlen = REDIS_READER_INITIAL_BUF;
+    }
+}
+
 int redisBufferRead(redisContext *c) {
-    char buf[1024*16];
-    int nread;
+    struct iovec iov[2];
+    int iovcnt = 0;
+    char *target;
+    size_t bulk, avail;
+    ssize_t nread;
 
     /* Return early when the context has seen an error. */
     if (c->err)
         return REDIS_ERR;
 
-    nread = read(c->fd,buf,sizeof(buf));
+    /* Read straight into the free space of the reader buffer. The rest of
+     * a large bulk string goes into its final buffer first, with whatever
+     * does not fit there landing in the reader buffer in the same syscall. */
+    if ((bulk = redisReaderGetBulkTarget(c->reader,&target)) > 0) {
+        iov[iovcnt].iov_base = target;
+        iov[iovcnt++].iov_len = bulk;
+    }
+    target = redisReaderReserve(c->reader,c->reader->readlen,&avail);
+    if (target == NULL) {
+        __redisSetError(c,c->reader->err,c->reader->errstr);
+        return REDIS_ERR;
+    }
+    iov[iovcnt].iov_base = target;
+    iov[iovcnt++].iov_len = avail;
+
+    if (iovcnt == 1)
+        nread = read(c->fd,target,avail);
+    else
+        nread = readv(c->fd,iov,iovcnt);
+
     if (nread == -1) {
         if ((errno == EAGAIN && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
             /* Try again later */
@@ -811,10 +946,16 @@ int redisBufferRead(redisContext *c) {
         __redisSetError(c,REDIS_ERR_EOF,"Server closed the connection");
         return REDIS_ERR;
     } else {
-        if (redisReaderFeed(c->reader,buf,nread) != REDIS_OK) {
-            __redisSetError(c,c->reader->err,c->reader->errstr);
-            return REDIS_ERR;
+        __redisAdaptReadSize(c->reader,bulk+avail,nread);
+        if (bulk > 0) {
+            size_t n = (size_t)nread < bulk ? (size_t)nread : bulk;
+            redisReaderCommitBulk(c->reader,n);
+            nread -= n;
         }
+        if (nread > 0)
+            redisReaderCommit(c->reader,nread);
+        if (c->flags & REDIS_QUICKACK)
+            redisContextRearmQuickAck(c);
     }
     return REDIS_OK;
 }
@@ -828,15 +969,76 @@ int redisBufferRead(redisContext *c) {
  * Returns REDIS_ERR if an error occured trying to write and sets
  * c->errstr to hold the appropriate error string.
  */
+/* Fill iov with the pending output, returns the number of entries used. */
+static int __redisOutputIov(redisContext *c, struct iovec *iov, int max) {
+    int i, n = 0;
+
+    for (i = 0; i < c->obufsegs && n < max; i++) {
+        size_t skip = i == 0 ? c->obufpos : 0;
+        if (c->obuf[i].len == skip)
+            continue;
+        iov[n].iov_base = c->obuf[i].buf+skip;
+        iov[n++].iov_len = c->obuf[i].len-skip;
+    }
+    return n;
+}
+
+/* Drop the first nwritten bytes of pending output. Sent chunks are freed,
+ * except that once everything is out the last one is kept for reuse, so a
+ * context that keeps writing does not reallocate its buffer. A kept chunk
+ * that grew past REDIS_OUTPUT_CHUNK is shrunk back, so one large burst of
+ * output does not pin its memory for the life of the context. */
+static void __redisOutputConsume(redisContext *c, size_t nwritten) {
+    int i, sent = 0, keep = -1;
+    char *buf;
+
+    c->obuflen -= nwritten;
+    nwritten += c->obufpos;
+    while (sent < c->obufsegs && nwritten >= c->obuf[sent].len) {
+        nwritten -= c->obuf[sent].len;
+        sent++;
+    }
+
+    if (sent == c->obufsegs) {
+        for (i = sent-1; i >= 0 && keep == -1; i--)
+            if (c->obuf[i].cap > 0)
+                keep = i;
+    }
+    for (i = 0; i < sent; i++)
+        if (i != keep && c->obuf[i].cap > 0)
+            free(c->obuf[i].buf);
+
+    if (keep != -1) {
+        c->obuf[0] = c->obuf[keep];
+        c->obuf[0].len = 0;
+        c->obufsegs = 1;
+        if (c->obuf[0].cap > REDIS_OUTPUT_CHUNK &&
+            (buf = realloc(c->obuf[0].buf,REDIS_OUTPUT_CHUNK)) != NULL) {
+            c->obuf[0].buf = buf;
+            c->obuf[0].cap = REDIS_OUTPUT_CHUNK;
+        }
+    } else {
+        memmove(c->obuf,c->obuf+sent,(c->obufsegs-sent)*sizeof(*c->obuf));
+        c->obufsegs -= sent;
+    }
+    c->obufpos = nwritten;
+}
+
 int redisBufferWrite(redisContext *c, int *done) {
-    int nwritten;
+    struct iovec iov[REDIS_WRITE_IOV];
+    ssize_t nwritten;
+    int iovcnt;
 
     /* Return early when the context has seen an error. */
     if (c->err)
         return REDIS_ERR;
 
-    if (sdslen(c->obuf) > 0) {
-        nwritten = write(c->fd,c->obuf,sdslen(c->obuf));
+    if (c->obuflen > 0) {
+        iovcnt = __redisOutputIov(c,iov,REDIS_WRITE_IOV);
+        if (iovcnt == 1)
+            nwritten = write(c->fd,iov[0].iov_base,iov[0].iov_len);
+        else
+            nwritten = writev(c->fd,iov,iovcnt);
         if (nwritten == -1) {
             if ((errno == EAGAIN && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
                 /* Try again later */
@@ -845,15 +1047,10 @@ int redisBufferWrite(redisContext *c, int *done) {
                 return REDIS_ERR;
             }
         } else if (nwritten > 0) {
-            if (nwritten == (signed)sdslen(c->obuf)) {
-                sdsfree(c->obuf);
-                c->obuf = sdsempty();
-            } else {
-                sdsrange(c->obuf,nwritten,-1);
-            }
+            __redisOutputConsume(c,nwritten);
         }
     }
-    if (done != NULL) *done = (sdslen(c->obuf) == 0);
+    if (done != NULL) *done = (c->obuflen == 0);
     return REDIS_OK;
 }
 
@@ -867,6 +1064,28 @@ int redisGetReplyFromReader(redisContext *c, void **reply) {
     return REDIS_OK;
 }
 
+/* Poll the socket without blocking until it has something to read, or the
+ * spin budget is used up. Either way the blocking read that follows then
+ * only sleeps when the reply is slow to arrive. */
+static void __redisSpinWait(redisContext *c) {
+    struct timespec now, deadline;
+    char peek;
+    ssize_t n;
+
+    clock_gettime(CLOCK_MONOTONIC,&deadline);
+    deadline.tv_nsec += (long)(c->spinwait%1000000)*1000;
+    deadline.tv_sec += c->spinwait/1000000+deadline.tv_nsec/1000000000;
+    deadline.tv_nsec %= 1000000000;
+
+    do {
+        n = recv(c->fd,&peek,1,MSG_PEEK|MSG_DONTWAIT);
+        if (n != -1 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            return; /* data, EOF or an error for the read to report */
+        clock_gettime(CLOCK_MONOTONIC,&now);
+    } while (now.tv_sec < deadline.tv_sec ||
+             (now.tv_sec == deadline.tv_sec && now.tv_nsec < deadline.tv_nsec));
+}
+
 int redisGetReply(redisContext *c, void **reply) {
     int wdone = 0;
     void *aux = NULL;
@@ -885,6 +1104,8 @@ int redisGetReply(redisContext *c, void **reply) {
 
         /* Read until there is a reply */
         do {
+            if (c->spinwait > 0)
+                __redisSpinWait(c);
             if (redisBufferRead(c) == REDIS_ERR)
                 return REDIS_ERR;
             if (redisGetReplyFromReader(c,&aux) == REDIS_ERR)
@@ -905,15 +1126,13 @@ int redisGetReply(redisContext *c, void **reply) {
  * the reply (or replies in pub/sub).
  */
 int __redisAppendCommand(redisContext *c, const char *cmd, size_t len) {
-    sds newbuf;
+    char *target;
 
-    newbuf = sdscatlen(c->obuf,cmd,len);
-    if (newbuf == NULL) {
-        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+    if ((target = redisAppendReserve(c,len)) == NULL)
         return REDIS_ERR;
-    }
 
-    c->obuf = newbuf;
+    memcpy(target,cmd,len);
+    redisAppendCommit(c,len);
     return REDIS_OK;
 }
 
@@ -977,6 +1196,134 @@ int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const s
     return REDIS_OK;
 }
 
+/* Add a segment at the tail of the output queue. */
+static redisOutputSegment *__redisOutputPush(redisContext *c) {
+    if (c->obufsegs == c->obufcap) {
+        int cap = c->obufcap ? c->obufcap*2 : 4;
+        redisOutputSegment *segs = realloc(c->obuf,cap*sizeof(*segs));
+        if (segs == NULL)
+            return NULL;
+        c->obuf = segs;
+        c->obufcap = cap;
+    }
+    return &c->obuf[c->obufsegs++];
+}
+
+static void __redisOutputFree(redisContext *c) {
+    int i;
+
+    for (i = 0; i < c->obufsegs; i++)
+        if (c->obuf[i].cap > 0)
+            free(c->obuf[i].buf);
+    free(c->obuf);
+    c->obuf = NULL;
+    c->obufsegs = c->obufcap = 0;
+    c->obufpos = c->obuflen = 0;
+}
+
+char *redisAppendReserve(redisContext *c, size_t len) {
+    redisOutputSegment *tail = c->obufsegs ? &c->obuf[c->obufsegs-1] : NULL;
+    size_t cap;
+
+    if (tail != NULL && tail->cap > 0 && tail->cap-tail->len >= len)
+        return tail->buf+tail->len;
+
+    /* Start a new chunk, twice as large as the previous one. An empty chunk
+     * that is too small is replaced rather than left in the queue. */
+    cap = tail != NULL && tail->cap > 0 ? tail->cap*2 : REDIS_OUTPUT_CHUNK;
+    if (cap > REDIS_OUTPUT_MAX_CHUNK) cap = REDIS_OUTPUT_MAX_CHUNK;
+    if (cap < len) cap = len;
+
+    if (tail == NULL || tail->cap == 0 || tail->len > 0) {
+        if ((tail = __redisOutputPush(c)) == NULL)
+            goto memory_err;
+        tail->buf = NULL;
+        tail->len = tail->cap = 0;
+    }
+    free(tail->buf);
+    if ((tail->buf = malloc(cap)) == NULL) {
+        c->obufsegs--;
+        goto memory_err;
+    }
+    tail->cap = cap;
+    return tail->buf;
+
+memory_err:
+    __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+    return NULL;
+}
+
+void redisAppendCommit(redisContext *c, size_t len) {
+    redisOutputSegment *tail = &c->obuf[c->obufsegs-1];
+
+    assert(tail->cap > 0 && tail->len+len <= tail->cap);
+    tail->len += len;
+    c->obuflen += len;
+}
+
+/* Write a "*<n>\r\n" or "$<n>\r\n" header, returns its length. */
+static size_t __redisFormatHeader(char *target, char type, size_t n) {
+    char digits[20], *p = digits+sizeof(digits);
+    size_t len;
+
+    do {
+        *--p = '0'+n%10;
+        n /= 10;
+    } while (n);
+
+    len = digits+sizeof(digits)-p;
+    target[0] = type;
+    memcpy(target+1,p,len);
+    target[len+1] = '\r';
+    target[len+2] = '\n';
+    return len+3;
+}
+
+int redisAppendCommandArgvRef(redisContext *c, int argc, const char **argv, const size_t *argvlen) {
+    redisOutputSegment *ref;
+    char *target;
+    size_t len, n;
+    int j;
+
+    /* Headers and small arguments are copied into the output buffer; large
+     * arguments are queued as a reference between two chunks. */
+    if ((target = redisAppendReserve(c,23)) == NULL)
+        return REDIS_ERR;
+    redisAppendCommit(c,__redisFormatHeader(target,'*',argc));
+
+    for (j = 0; j < argc; j++) {
+        len = argvlen ? argvlen[j] : strlen(argv[j]);
+
+        if (len >= REDIS_WRITE_REF_MIN) {
+            if ((target = redisAppendReserve(c,23)) == NULL)
+                return REDIS_ERR;
+            redisAppendCommit(c,__redisFormatHeader(target,'$',len));
+
+            if ((ref = __redisOutputPush(c)) == NULL) {
+                __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+                return REDIS_ERR;
+            }
+            ref->buf = (char*)argv[j];
+            ref->len = len;
+            ref->cap = 0;
+            c->obuflen += len;
+
+            if ((target = redisAppendReserve(c,2)) == NULL)
+                return REDIS_ERR;
+            memcpy(target,"\r\n",2);
+            redisAppendCommit(c,2);
+        } else {
+            if ((target = redisAppendReserve(c,len+25)) == NULL)
+                return REDIS_ERR;
+            n = __redisFormatHeader(target,'$',len);
+            memcpy(target+n,argv[j],len);
+            memcpy(target+n+len,"\r\n",2);
+            redisAppendCommit(c,n+len+2);
+        }
+    }
+    return REDIS_OK;
+}
+
 /* Helper function for the redisCommand* family of functions.
  *
  * Write a formatted command to the output buffer. If the given context is
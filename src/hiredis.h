@@ -74,6 +74,10 @@
 /* Flag that is set when we should set SO_REUSEADDR before calling bind() */
 #define REDIS_REUSEADDR 0x80
 
+/* Flag that is set when TCP_QUICKACK should be re-armed after every read,
+ * since the kernel clears it on its own. */
+#define REDIS_QUICKACK 0x100
+
 #define REDIS_KEEPALIVE_INTERVAL 15 /* seconds */
 
 /* number of times we retry to connect in the case of EADDRNOTAVAIL and
@@ -111,11 +115,16 @@ extern "C" {
 /* This is the reply object returned by redisCommand() */
 typedef struct redisReply {
     int type; /* REDIS_REPLY_* */
-    long long integer; /* The integer when type is REDIS_REPLY_INTEGER */
+    long long integer; /* The integer when type is REDIS_REPLY_INTEGER, 0 or 1
+                          for REDIS_REPLY_BOOL */
+    double dval; /* The double when type is REDIS_REPLY_DOUBLE */
     int len; /* Length of string */
-    char *str; /* Used for both REDIS_REPLY_ERROR and REDIS_REPLY_STRING */
-    size_t elements; /* number of elements, for REDIS_REPLY_ARRAY */
-    struct redisReply **element; /* elements vector for REDIS_REPLY_ARRAY */
+    char *str; /* Used for REDIS_REPLY_ERROR, REDIS_REPLY_STRING, and the text
+                  of REDIS_REPLY_DOUBLE, REDIS_REPLY_BIGNUM and REDIS_REPLY_VERB */
+    char vtype[4]; /* Format of REDIS_REPLY_VERB ("txt", "mkd"), NUL-terminated */
+    size_t elements; /* number of elements, for aggregate replies (key and
+                        value count separately in REDIS_REPLY_MAP) */
+    struct redisReply **element; /* elements vector for aggregate replies */
 } redisReply;
 
 redisReader *redisReaderCreate(void);
@@ -136,13 +145,39 @@ enum redisConnectionType {
     REDIS_CONN_UNIX,
 };
 
+/* Arguments of at least this many bytes are not copied into the output
+ * buffer by redisAppendCommandArgvRef(). */
+#define REDIS_WRITE_REF_MIN (1024*16)
+
+/* Most pieces of output handed to a single writev(). */
+#define REDIS_WRITE_IOV 64
+
+/* The output buffer is a queue of chunks, starting at REDIS_OUTPUT_CHUNK
+ * bytes and doubling up to REDIS_OUTPUT_MAX_CHUNK, so queued output is never
+ * moved or realloc'ed as it grows. Once it drains, a single chunk of
+ * REDIS_OUTPUT_CHUNK bytes is kept for reuse. */
+#define REDIS_OUTPUT_CHUNK (1024*16)
+#define REDIS_OUTPUT_MAX_CHUNK (1024*1024)
+
+/* A piece of pending output: a chunk owned by the context, or a caller-owned
+ * buffer (cap is 0) queued by redisAppendCommandArgvRef(). */
+typedef struct redisOutputSegment {
+    char *buf;
+    size_t len; /* Bytes queued */
+    size_t cap; /* Allocated size, 0 for a caller-owned buffer */
+} redisOutputSegment;
+
 /* Context for a connection to Redis */
 typedef struct redisContext {
     int err; /* Error flags, 0 when there is no error */
     char errstr[128]; /* String representation of error when applicable */
     int fd;
     int flags;
-    char *obuf; /* Write buffer */
+    redisOutputSegment *obuf; /* Write buffer */
+    int obufsegs; /* Segments in use */
+    int obufcap; /* Allocated segments */
+    size_t obufpos; /* Bytes of obuf[0] already written */
+    size_t obuflen; /* Bytes waiting to be written */
     redisReader *reader; /* Protocol reader */
 
     enum redisConnectionType connection_type;
@@ -152,12 +187,27 @@ typedef struct redisContext {
         char *host;
         char *source_addr;
         int port;
+        struct addrinfo *addrs; /* Cached resolution of host, see net.c */
+        long resolved; /* When addrs was resolved, monotonic milliseconds */
     } tcp;
 
     struct {
         char *path;
     } unix_sock;
 
+    int spinwait; /* Microseconds to busy-poll for a reply before blocking */
+
+    /* Socket options set through the calls in net.h, applied again to the
+     * new socket by redisReconnect. */
+    struct {
+        int rcvbuf; /* SO_RCVBUF, 0 for the system default */
+        int sndbuf; /* SO_SNDBUF, 0 for the system default */
+        int nodelay; /* TCP_NODELAY, on unless turned off */
+        int keepalive; /* Keepalive interval in seconds, 0 when off */
+        int busypoll; /* SO_BUSY_POLL in microseconds, 0 when off */
+        struct timeval rwtimeout; /* SO_RCVTIMEO/SO_SNDTIMEO, zero for none */
+    } sockopt;
+
 } redisContext;
 
 redisContext *redisConnect(const char *ip, int port);
@@ -184,6 +234,12 @@ redisContext *redisConnectFd(int fd);
 int redisReconnect(redisContext *c);
 
 int redisSetTimeout(redisContext *c, const struct timeval tv);
+
+/* Low-latency mode for blocking contexts: spin on the socket for up to usec
+ * microseconds waiting for a reply before falling back to a blocking read.
+ * This burns a core while waiting, so it is only worth it on dedicated
+ * cores. 0 disables it. */
+int redisSetSpinWait(redisContext *c, int usec);
 int redisEnableKeepAlive(redisContext *c);
 void redisFree(redisContext *c);
 int redisFreeKeepFd(redisContext *c);
@@ -207,6 +263,19 @@ int redisvAppendCommand(redisContext *c, const char *format, va_list ap);
 int redisAppendCommand(redisContext *c, const char *format, ...);
 int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
 
+/* Encode a command in place: reserve room for at least len bytes at the end
+ * of the output buffer, write the protocol there, then commit the number of
+ * bytes actually written. Returns NULL on error. */
+char *redisAppendReserve(redisContext *c, size_t len);
+void redisAppendCommit(redisContext *c, size_t len);
+
+/* Like redisAppendCommandArgv, but arguments of REDIS_WRITE_REF_MIN bytes or
+ * more are referenced instead of copied, and sent with writev(). They must
+ * stay valid and unchanged until they have been written, i.e. until
+ * redisBufferWrite() reports done or, in a blocking context, until
+ * redisGetReply() returns. */
+int redisAppendCommandArgvRef(redisContext *c, int argc, const char **argv, const size_t *argvlen);
+
 /* Issue a command to Redis. In a blocking context, it is identical to calling
  * redisAppendCommand, followed by redisGetReply. The function will return
  * NULL if there was an error in performing the request, otherwise it will
@@ -50,6 +50,7 @@
 #include <poll.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "net.h"
 #include "sds.h"
@@ -99,7 +100,7 @@ static int redisCreateSocket(redisContext *c, int type) {
     return REDIS_OK;
 }
 
-static int redisSetBlocking(redisContext *c, int blocking) {
+int redisSetBlocking(redisContext *c, int blocking) {
     int flags;
 
     /* Set the socket nonblocking.
@@ -128,6 +129,8 @@ int redisKeepAlive(redisContext *c, int interval) {
     int val = 1;
     int fd = c->fd;
 
+    c->sockopt.keepalive = interval;
+
     if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val)) == -1){
         __redisSetError(c,REDIS_ERR_OTHER,strerror(errno));
         return REDIS_ERR;
@@ -176,6 +179,81 @@ static int redisSetTcpNoDelay(redisContext *c) {
     return REDIS_OK;
 }
 
+int redisContextSetSocketBuffers(redisContext *c, int rcvbuf, int sndbuf) {
+    c->sockopt.rcvbuf = rcvbuf;
+    c->sockopt.sndbuf = sndbuf;
+    if (rcvbuf > 0 &&
+        setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"setsockopt(SO_RCVBUF)");
+        return REDIS_ERR;
+    }
+    if (sndbuf > 0 &&
+        setsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"setsockopt(SO_SNDBUF)");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+int redisContextSetTcpNoDelay(redisContext *c, int enabled) {
+    c->sockopt.nodelay = enabled;
+    if (setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled)) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"setsockopt(TCP_NODELAY)");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Ask for ACKs to be sent right away rather than delayed. Linux drops back
+ * to delayed ACKs by itself, so with REDIS_QUICKACK set the option is
+ * re-armed after every read, see redisBufferRead(). */
+int redisContextSetQuickAck(redisContext *c, int enabled) {
+#ifdef TCP_QUICKACK
+    if (setsockopt(c->fd, IPPROTO_TCP, TCP_QUICKACK, &enabled, sizeof(enabled)) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"setsockopt(TCP_QUICKACK)");
+        return REDIS_ERR;
+    }
+    if (enabled)
+        c->flags |= REDIS_QUICKACK;
+    else
+        c->flags &= ~REDIS_QUICKACK;
+    return REDIS_OK;
+#else
+    if (!enabled)
+        return REDIS_OK;
+    __redisSetError(c,REDIS_ERR_OTHER,"TCP_QUICKACK is not supported");
+    return REDIS_ERR;
+#endif
+}
+
+/* Called after reads while REDIS_QUICKACK is set. A failure only costs a
+ * delayed ACK, so it does not fail the read. */
+void redisContextRearmQuickAck(redisContext *c) {
+#ifdef TCP_QUICKACK
+    int on = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+#else
+    (void)c;
+#endif
+}
+
+/* Busy-poll the device queue for up to usec microseconds on blocking reads. */
+int redisContextSetBusyPoll(redisContext *c, int usec) {
+    c->sockopt.busypoll = usec;
+#ifdef SO_BUSY_POLL
+    if (setsockopt(c->fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1) {
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,"setsockopt(SO_BUSY_POLL)");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+#else
+    if (usec == 0)
+        return REDIS_OK;
+    __redisSetError(c,REDIS_ERR_OTHER,"SO_BUSY_POLL is not supported");
+    return REDIS_ERR;
+#endif
+}
+
 #define __MAX_MSEC (((LONG_MAX) - 999) / 1000)
 
 static int redisContextWaitReady(redisContext *c, const struct timeval *timeout) {
@@ -245,6 +323,7 @@ int redisCheckSocketError(redisContext *c) {
 }
 
 int redisContextSetTimeout(redisContext *c, const struct timeval tv) {
+    c->sockopt.rwtimeout = tv;
     if (setsockopt(c->fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv)) == -1) {
         __redisSetErrorFromErrno(c,REDIS_ERR_IO,"setsockopt(SO_RCVTIMEO)");
         return REDIS_ERR;
@@ -256,18 +335,287 @@ int redisContextSetTimeout(redisContext *c, const struct timeval tv) {
     return REDIS_OK;
 }
 
+int redisContextRestoreSocketOptions(redisContext *c) {
+    int tcp = (c->connection_type == REDIS_CONN_TCP);
+
+    if ((c->sockopt.rcvbuf > 0 || c->sockopt.sndbuf > 0) &&
+        redisContextSetSocketBuffers(c,c->sockopt.rcvbuf,c->sockopt.sndbuf) != REDIS_OK)
+        return REDIS_ERR;
+    if (tcp && !c->sockopt.nodelay && redisContextSetTcpNoDelay(c,0) != REDIS_OK)
+        return REDIS_ERR;
+    if (tcp && (c->flags & REDIS_QUICKACK) && redisContextSetQuickAck(c,1) != REDIS_OK)
+        return REDIS_ERR;
+    if (tcp && c->sockopt.keepalive > 0 && redisKeepAlive(c,c->sockopt.keepalive) != REDIS_OK)
+        return REDIS_ERR;
+    if (c->sockopt.busypoll > 0 && redisContextSetBusyPoll(c,c->sockopt.busypoll) != REDIS_OK)
+        return REDIS_ERR;
+    if ((c->sockopt.rwtimeout.tv_sec > 0 || c->sockopt.rwtimeout.tv_usec > 0) &&
+        redisContextSetTimeout(c,c->sockopt.rwtimeout) != REDIS_OK)
+        return REDIS_ERR;
+    return REDIS_OK;
+}
+
+static long redisMonotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+void redisContextFreeAddrCache(redisContext *c) {
+    if (c->tcp.addrs != NULL) {
+        freeaddrinfo(c->tcp.addrs);
+        c->tcp.addrs = NULL;
+    }
+}
+
+/* Resolve c->tcp.host, reusing the previous answer for up to
+ * REDIS_ADDR_CACHE_TTL seconds so that reconnects skip DNS. */
+static int redisContextResolveTcp(redisContext *c, const char *port, int *cached) {
+    struct addrinfo hints;
+    int rv;
+
+    *cached = c->tcp.addrs != NULL &&
+              redisMonotonicMs()-c->tcp.resolved < REDIS_ADDR_CACHE_TTL*1000;
+    if (*cached)
+        return REDIS_OK;
+
+    redisContextFreeAddrCache(c);
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((rv = getaddrinfo(c->tcp.host,port,&hints,&c->tcp.addrs)) != 0) {
+        c->tcp.addrs = NULL;
+        __redisSetError(c,REDIS_ERR_OTHER,gai_strerror(rv));
+        return REDIS_ERR;
+    }
+    c->tcp.resolved = redisMonotonicMs();
+    return REDIS_OK;
+}
+
+static int redisBindSourceAddr(redisContext *c, int s, int family) {
+    struct addrinfo hints, *bservinfo, *b;
+    int rv, n, bound = 0;
+
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    /* Using getaddrinfo saves us from self-determining IPv4 vs IPv6 */
+    if ((rv = getaddrinfo(c->tcp.source_addr, NULL, &hints, &bservinfo)) != 0) {
+        char buf[128];
+        snprintf(buf,sizeof(buf),"Can't get addr: %s",gai_strerror(rv));
+        __redisSetError(c,REDIS_ERR_OTHER,buf);
+        return REDIS_ERR;
+    }
+
+    if (c->flags & REDIS_REUSEADDR) {
+        n = 1;
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*) &n,
+                       sizeof(n)) < 0) {
+            freeaddrinfo(bservinfo);
+            return REDIS_ERR;
+        }
+    }
+
+    for (b = bservinfo; b != NULL; b = b->ai_next) {
+        if (bind(s,b->ai_addr,b->ai_addrlen) != -1) {
+            bound = 1;
+            break;
+        }
+    }
+    freeaddrinfo(bservinfo);
+    if (!bound) {
+        char buf[128];
+        snprintf(buf,sizeof(buf),"Can't bind socket: %s",strerror(errno));
+        __redisSetError(c,REDIS_ERR_OTHER,buf);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Try the addresses one at a time, the socket is left in c->fd. */
+static int redisContextConnectSequential(redisContext *c, struct addrinfo **addrs, int naddrs) {
+    int s, i;
+    int blocking = (c->flags & REDIS_BLOCK);
+    int reuseaddr = (c->flags & REDIS_REUSEADDR);
+    int reuses = 0;
+    struct addrinfo *p;
+
+    for (i = 0; i < naddrs; i++) {
+        p = addrs[i];
+addrretry:
+        if ((s = socket(p->ai_family,p->ai_socktype,p->ai_protocol)) == -1)
+            continue;
+
+        c->fd = s;
+        if (redisSetBlocking(c,0) != REDIS_OK)
+            return REDIS_ERR;
+        if (c->tcp.source_addr && redisBindSourceAddr(c,s,p->ai_family) != REDIS_OK)
+            return REDIS_ERR;
+        if (connect(s,p->ai_addr,p->ai_addrlen) == -1) {
+            if (errno == EHOSTUNREACH) {
+                redisContextCloseFd(c);
+                continue;
+            } else if (errno == EINPROGRESS && !blocking) {
+                /* This is ok. */
+            } else if (errno == EADDRNOTAVAIL && reuseaddr) {
+                if (++reuses >= REDIS_CONNECT_RETRIES) {
+                    return REDIS_ERR;
+                } else {
+                    goto addrretry;
+                }
+            } else {
+                if (redisContextWaitReady(c,c->timeout) != REDIS_OK)
+                    return REDIS_ERR;
+            }
+        }
+        return REDIS_OK;
+    }
+
+    char buf[128];
+    snprintf(buf,sizeof(buf),"Can't create socket: %s",strerror(errno));
+    __redisSetError(c,REDIS_ERR_OTHER,buf);
+    return REDIS_ERR;
+}
+
+/* Happy Eyeballs (RFC 8305) for blocking contexts: start a connection
+ * attempt to the next address every REDIS_CONNECT_STAGGER ms, or as soon
+ * as an attempt fails, and keep whichever completes first. A dead or slow
+ * address then costs one stagger instead of a full connect timeout. The
+ * socket is left in c->fd. */
+static int redisContextConnectParallel(redisContext *c, struct addrinfo **addrs, int naddrs) {
+    struct pollfd *pfd;
+    struct addrinfo *p;
+    long now, nextstart = 0, deadline = -1, wait;
+    int s, i, rv, soerr, inflight = 0, next = 0, winner = -1, err = ECONNREFUSED;
+    int reuseaddr = (c->flags & REDIS_REUSEADDR);
+    int reuses = 0;
+    socklen_t errlen;
+
+    if ((pfd = malloc(naddrs*sizeof(*pfd))) == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+
+    if (c->timeout != NULL) {
+        if (c->timeout->tv_usec > 1000000 || c->timeout->tv_sec > __MAX_MSEC) {
+            free(pfd);
+            errno = EINVAL;
+            __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+            return REDIS_ERR;
+        }
+        deadline = redisMonotonicMs()+c->timeout->tv_sec*1000+
+                   (c->timeout->tv_usec+999)/1000;
+    }
+
+    while (winner == -1) {
+        now = redisMonotonicMs();
+        if (deadline != -1 && now >= deadline) {
+            err = ETIMEDOUT;
+            break;
+        }
+
+        if (next < naddrs && (inflight == 0 || now >= nextstart)) {
+            p = addrs[next++];
+            if ((s = socket(p->ai_family,p->ai_socktype,p->ai_protocol)) == -1) {
+                err = errno;
+                continue;
+            }
+
+            c->fd = s;
+            if (redisSetBlocking(c,0) != REDIS_OK)
+                goto error;
+            if (c->tcp.source_addr && redisBindSourceAddr(c,s,p->ai_family) != REDIS_OK)
+                goto error;
+            c->fd = -1;
+
+            if (connect(s,p->ai_addr,p->ai_addrlen) == 0) {
+                winner = s;
+                break;
+            } else if (errno == EADDRNOTAVAIL && reuseaddr &&
+                       ++reuses < REDIS_CONNECT_RETRIES) {
+                /* Out of local ports: try the same address again, as the
+                 * sequential path does. */
+                close(s);
+                next--;
+                continue;
+            } else if (errno != EINPROGRESS) {
+                err = errno;
+                close(s);
+                continue;
+            }
+            pfd[inflight].fd = s;
+            pfd[inflight].events = POLLOUT;
+            pfd[inflight].revents = 0;
+            inflight++;
+            nextstart = now+REDIS_CONNECT_STAGGER;
+        }
+
+        /* Every address was tried and failed. */
+        if (inflight == 0)
+            break;
+
+        wait = next < naddrs ? nextstart-now : -1;
+        if (deadline != -1 && (wait == -1 || deadline-now < wait))
+            wait = deadline-now;
+        if ((rv = poll(pfd,inflight,wait < 0 ? -1 : (int)wait)) == -1) {
+            if (errno == EINTR)
+                continue;
+            err = errno;
+            break;
+        }
+
+        for (i = 0; i < inflight && rv > 0; i++) {
+            if (pfd[i].revents == 0)
+                continue;
+
+            soerr = 0;
+            errlen = sizeof(soerr);
+            if (getsockopt(pfd[i].fd,SOL_SOCKET,SO_ERROR,&soerr,&errlen) == -1)
+                soerr = errno;
+            if (soerr == 0) {
+                winner = pfd[i].fd;
+                pfd[i] = pfd[--inflight];
+                break;
+            }
+
+            /* A failed attempt lets the next address start right away. */
+            err = soerr;
+            close(pfd[i].fd);
+            pfd[i--] = pfd[--inflight];
+            nextstart = now;
+        }
+    }
+
+    for (i = 0; i < inflight; i++)
+        close(pfd[i].fd);
+    free(pfd);
+
+    if (winner == -1) {
+        errno = err;
+        __redisSetErrorFromErrno(c,REDIS_ERR_IO,NULL);
+        return REDIS_ERR;
+    }
+    c->fd = winner;
+    return REDIS_OK;
+
+error:
+    for (i = 0; i < inflight; i++)
+        close(pfd[i].fd);
+    free(pfd);
+    redisContextCloseFd(c);
+    return REDIS_ERR;
+}
+
 static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
                                    const struct timeval *timeout,
                                    const char *source_addr) {
-    int s, rv, n;
+    int rv, i, j, n, cached;
     char _port[6];  /* strlen("65535"); */
-    struct addrinfo hints, *servinfo, *bservinfo, *p, *b;
+    struct addrinfo *p, **addrs;
     int blocking = (c->flags & REDIS_BLOCK);
-    int reuseaddr = (c->flags & REDIS_REUSEADDR);
-    int reuses = 0;
 
     c->connection_type = REDIS_CONN_TCP;
-    c->tcp.port = port;
 
     /* We need to take possession of the passed parameters
      * to make them reusable for a reconnect.
@@ -281,7 +629,11 @@ static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
             free(c->tcp.host);
 
         c->tcp.host = strdup(addr);
+        redisContextFreeAddrCache(c);
     }
+    if (c->tcp.port != port)
+        redisContextFreeAddrCache(c);
+    c->tcp.port = port;
 
     if (timeout) {
         if (c->timeout != timeout) {
@@ -305,100 +657,59 @@ static int _redisContextConnectTcp(redisContext *c, const char *addr, int port,
     }
 
     snprintf(_port, 6, "%d", port);
-    memset(&hints,0,sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
-    /* Try with IPv6 if no IPv4 address was found. We do it in this order since
-     * in a Redis client you can't afford to test if you have IPv6 connectivity
-     * as this would add latency to every connect. Otherwise a more sensible
-     * route could be: Use IPv6 if both addresses are available and there is IPv6
-     * connectivity. */
-    if ((rv = getaddrinfo(c->tcp.host,_port,&hints,&servinfo)) != 0) {
-         hints.ai_family = AF_INET6;
-         if ((rv = getaddrinfo(addr,_port,&hints,&servinfo)) != 0) {
-            __redisSetError(c,REDIS_ERR_OTHER,gai_strerror(rv));
-            return REDIS_ERR;
-        }
-    }
-    for (p = servinfo; p != NULL; p = p->ai_next) {
-addrretry:
-        if ((s = socket(p->ai_family,p->ai_socktype,p->ai_protocol)) == -1)
-            continue;
-
-        c->fd = s;
-        if (redisSetBlocking(c,0) != REDIS_OK)
-            goto error;
-        if (c->tcp.source_addr) {
-            int bound = 0;
-            /* Using getaddrinfo saves us from self-determining IPv4 vs IPv6 */
-            if ((rv = getaddrinfo(c->tcp.source_addr, NULL, &hints, &bservinfo)) != 0) {
-                char buf[128];
-                snprintf(buf,sizeof(buf),"Can't get addr: %s",gai_strerror(rv));
-                __redisSetError(c,REDIS_ERR_OTHER,buf);
-                goto error;
-            }
 
-            if (reuseaddr) {
-                n = 1;
-                if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*) &n,
-                               sizeof(n)) < 0) {
-                    goto error;
-                }
-            }
+resolve:
+    if (redisContextResolveTcp(c,_port,&cached) != REDIS_OK)
+        return REDIS_ERR;
 
-            for (b = bservinfo; b != NULL; b = b->ai_next) {
-                if (bind(s,b->ai_addr,b->ai_addrlen) != -1) {
-                    bound = 1;
-                    break;
-                }
-            }
-            freeaddrinfo(bservinfo);
-            if (!bound) {
-                char buf[128];
-                snprintf(buf,sizeof(buf),"Can't bind socket: %s",strerror(errno));
-                __redisSetError(c,REDIS_ERR_OTHER,buf);
-                goto error;
-            }
-        }
-        if (connect(s,p->ai_addr,p->ai_addrlen) == -1) {
-            if (errno == EHOSTUNREACH) {
-                redisContextCloseFd(c);
-                continue;
-            } else if (errno == EINPROGRESS && !blocking) {
-                /* This is ok. */
-            } else if (errno == EADDRNOTAVAIL && reuseaddr) {
-                if (++reuses >= REDIS_CONNECT_RETRIES) {
-                    goto error;
-                } else {
-                    goto addrretry;
-                }
-            } else {
-                if (redisContextWaitReady(c,c->timeout) != REDIS_OK)
-                    goto error;
-            }
+    /* IPv4 addresses come first: a client can't afford to wait for broken
+     * IPv6 connectivity. With parallel attempts IPv6 no longer has to be a
+     * last resort, so there the families alternate. */
+    for (n = 0, p = c->tcp.addrs; p != NULL; p = p->ai_next)
+        n++;
+    if ((addrs = malloc(n*sizeof(*addrs))) == NULL) {
+        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+        return REDIS_ERR;
+    }
+    for (i = 0, p = c->tcp.addrs; p != NULL; p = p->ai_next)
+        if (p->ai_family == AF_INET) addrs[i++] = p;
+    for (j = 0, p = c->tcp.addrs; p != NULL; p = p->ai_next) {
+        if (p->ai_family == AF_INET) continue;
+        /* slot the j-th other address in after the j-th IPv4 one */
+        if (blocking && 2*j+1 < i) {
+            memmove(addrs+2*j+2,addrs+2*j+1,(i-2*j-1)*sizeof(*addrs));
+            addrs[2*j+1] = p;
+        } else {
+            addrs[i] = p;
         }
-        if (blocking && redisSetBlocking(c,1) != REDIS_OK)
-            goto error;
-        if (redisSetTcpNoDelay(c) != REDIS_OK)
-            goto error;
-
-        c->flags |= REDIS_CONNECTED;
-        rv = REDIS_OK;
-        goto end;
+        i++;
+        j++;
     }
-    if (p == NULL) {
-        char buf[128];
-        snprintf(buf,sizeof(buf),"Can't create socket: %s",strerror(errno));
-        __redisSetError(c,REDIS_ERR_OTHER,buf);
-        goto error;
+
+    if (blocking && n > 1)
+        rv = redisContextConnectParallel(c,addrs,n);
+    else
+        rv = redisContextConnectSequential(c,addrs,n);
+    free(addrs);
+
+    /* After a failover the cached answer may be stale: resolve again before
+     * giving up. */
+    if (rv != REDIS_OK && cached) {
+        redisContextFreeAddrCache(c);
+        c->err = 0;
+        c->errstr[0] = '\0';
+        goto resolve;
     }
+    if (rv != REDIS_OK)
+        return REDIS_ERR;
 
-error:
-    rv = REDIS_ERR;
-end:
-    freeaddrinfo(servinfo);
-    return rv;  // Need to return REDIS_OK if alright
+    if (blocking && redisSetBlocking(c,1) != REDIS_OK)
+        return REDIS_ERR;
+    if (redisSetTcpNoDelay(c) != REDIS_OK)
+        return REDIS_ERR;
+
+    c->flags |= REDIS_CONNECTED;
+    return REDIS_OK;
 }
 
 int redisContextConnectTcp(redisContext *c, const char *addr, int port,
@@ -41,7 +41,20 @@
 #define AF_LOCAL AF_UNIX
 #endif
 
+/* Resolved addresses are reused by reconnects for this many seconds. */
+#define REDIS_ADDR_CACHE_TTL 60
+
+/* Delay before a blocking connect also tries the next address while the
+ * previous attempts are still pending, in milliseconds. */
+#define REDIS_CONNECT_STAGGER 100
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 int redisCheckSocketError(redisContext *c);
+/* Only switches the socket mode, REDIS_BLOCK in c->flags is up to the caller. */
+int redisSetBlocking(redisContext *c, int blocking);
 int redisContextSetTimeout(redisContext *c, const struct timeval tv);
 int redisContextConnectTcp(redisContext *c, const char *addr, int port, const struct timeval *timeout);
 int redisContextConnectBindTcp(redisContext *c, const char *addr, int port,
@@ -49,5 +62,20 @@ int redisContextConnectBindTcp(redisContext *c, const char *addr, int port,
                                const char *source_addr);
 int redisContextConnectUnix(redisContext *c, const char *path, const struct timeval *timeout);
 int redisKeepAlive(redisContext *c, int interval);
+void redisContextFreeAddrCache(redisContext *c);
+
+/* Socket tuning. Buffer sizes of 0 keep the system default. */
+int redisContextSetSocketBuffers(redisContext *c, int rcvbuf, int sndbuf);
+int redisContextSetTcpNoDelay(redisContext *c, int enabled);
+int redisContextSetQuickAck(redisContext *c, int enabled);
+int redisContextSetBusyPoll(redisContext *c, int usec);
+void redisContextRearmQuickAck(redisContext *c);
+
+/* Apply the options recorded in c->sockopt to a new socket. */
+int redisContextRestoreSocketOptions(redisContext *c);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
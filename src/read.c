@@ -39,9 +39,20 @@
 #include <assert.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdint.h>
+#include <math.h>
 
 #include "read.h"
-#include "sds.h"
+
+/* Blob errors ("!") are read like bulk strings and reported as
+ * REDIS_REPLY_ERROR once complete; this type only lives in the task, and
+ * is outside the REDIS_REPLY_* range (negative types are unread ones). */
+#define REDIS_READER_BLOB_ERROR 100
+
+/* Longest double accepted, matches what the server may send for %.17g. */
+#define REDIS_READER_MAX_DOUBLE 326
 
 static void __redisReaderSetError(redisReader *r, int type, const char *str) {
     size_t len;
@@ -53,13 +64,21 @@ static void __redisReaderSetError(redisReader *r, int type, const char *str) {
 
     /* Clear input buffer on errors. */
     if (r->buf != NULL) {
-        sdsfree(r->buf);
+        free(r->buf);
         r->buf = NULL;
-        r->pos = r->len = 0;
+        r->pos = r->len = r->cap = 0;
+    }
+
+    /* Drop a partially read large bulk string. */
+    if (r->bulk != NULL) {
+        free(r->bulk);
+        r->bulk = NULL;
+        r->bulklen = r->bulkpos = r->bulkcap = 0;
     }
 
     /* Reset task stack. */
     r->ridx = -1;
+    r->attridx = -1;
 
     /* Set error. */
     r->err = type;
@@ -116,60 +135,165 @@ static char *readBytes(redisReader *r, unsigned int bytes) {
     return NULL;
 }
 
-/* Find pointer to \r\n. */
-static char *seekNewline(char *s, size_t len) {
-    int pos = 0;
-    int _len = len-1;
-
-    /* Position should be < len-1 because the character at "pos" should be
-     * followed by a \n. Note that strchr cannot be used because it doesn't
-     * allow to search a limited length and the buffer that is being searched
-     * might not have a trailing NULL character. */
-    while (pos < _len) {
-        while(pos < _len && s[pos] != '\r') pos++;
-        if (s[pos] != '\r') {
-            /* Not found. */
-            return NULL;
-        } else {
-            if (s[pos+1] == '\n') {
-                /* Found. */
-                return s+pos;
-            } else {
-                /* Continue searching. */
-                pos++;
-            }
-        }
+/* Portable fallback: let memchr() find candidate \r bytes and check that each
+ * one is followed by a \n. Position should be < len-1 because the character
+ * at "pos" should be followed by a \n. Note that strchr cannot be used because
+ * it doesn't allow to search a limited length and the buffer that is being
+ * searched might not have a trailing NULL character. */
+static char *seekNewlineScalar(char *s, size_t len) {
+    char *p = s, *last;
+
+    if (len < 2)
+        return NULL;
+
+    last = s+len-1;
+    while (p < last && (p = memchr(p,'\r',last-p)) != NULL) {
+        if (p[1] == '\n')
+            return p;
+        p++;
     }
     return NULL;
 }
 
-/* Read a long long value starting at *s, under the assumption that it will be
- * terminated by \r\n. Ambiguously returns -1 for unexpected input. */
-static long long readLongLong(char *s) {
-    long long v = 0;
-    int dec, mult = 1;
-    char c;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_SEEKNEWLINE_SIMD 1
+
+/* Test 16 candidate positions at once: a byte is a match when it is \r and
+ * the byte after it is \n. The second load reads one byte ahead, so the
+ * vector loop stops 17 bytes before the end and the scalar code does the
+ * rest. */
+__attribute__((target("sse2")))
+static char *seekNewlineSSE2(char *s, size_t len) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t pos = 0;
+    int mask;
+
+    while (pos+17 <= len) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s+pos));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s+pos+1));
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a,cr),
+                                               _mm_cmpeq_epi8(b,lf)));
+        if (mask)
+            return s+pos+__builtin_ctz(mask);
+        pos += 16;
+    }
+    return seekNewlineScalar(s+pos,len-pos);
+}
 
-    if (*s == '-') {
-        mult = -1;
-        s++;
-    } else if (*s == '+') {
-        mult = 1;
+/* Same as above, 32 positions at a time. Short lines are the common case,
+ * so fall back to the SSE2 kernel for the tail. */
+__attribute__((target("avx2")))
+static char *seekNewlineAVX2(char *s, size_t len) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t pos = 0;
+    unsigned int mask;
+
+    while (pos+33 <= len) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s+pos));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s+pos+1));
+        mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a,cr),_mm256_cmpeq_epi8(b,lf)));
+        if (mask)
+            return s+pos+__builtin_ctz(mask);
+        pos += 32;
+    }
+    return seekNewlineSSE2(s+pos,len-pos);
+}
+
+static char *seekNewlineResolve(char *s, size_t len);
+static char *(*seekNewlineImpl)(char *, size_t) = seekNewlineResolve;
+
+/* Pick the widest kernel the CPU supports on first use. Readers on several
+ * threads may get here at once, so the pointer is only accessed atomically;
+ * relaxed ordering is enough as every thread stores the same value and it
+ * points to code, not to data that needs publishing. */
+static char *seekNewlineResolve(char *s, size_t len) {
+    char *(*impl)(char *, size_t);
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        impl = seekNewlineAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        impl = seekNewlineSSE2;
+    else
+        impl = seekNewlineScalar;
+    __atomic_store_n(&seekNewlineImpl,impl,__ATOMIC_RELAXED);
+    return impl(s,len);
+}
+#endif
+
+/* Find pointer to \r\n. */
+static char *seekNewline(char *s, size_t len) {
+#ifdef HAVE_SEEKNEWLINE_SIMD
+    return __atomic_load_n(&seekNewlineImpl,__ATOMIC_RELAXED)(s,len);
+#else
+    return seekNewlineScalar(s,len);
+#endif
+}
+
+/* Convert 1 to 4 ASCII digits in one go (SWAR). The digits are right-aligned
+ * in a word padded with '0', most significant digit in the lowest byte, so
+ * that pairs of bytes and then pairs of pairs can be combined with a
+ * multiply-and-shift each. Returns -1 when a byte is not a digit. */
+static int parseDigits4(const char *s, size_t len) {
+    unsigned char b[4] = { '0', '0', '0', '0' };
+    uint32_t x;
+
+    memcpy(b+4-len,s,len);
+    x = (uint32_t)b[0] | (uint32_t)b[1] << 8 |
+        (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+
+    /* Every byte must be 0x30..0x3f and stay below 0x40 after adding 6. */
+    if (((x & 0xF0F0F0F0) | (((x + 0x06060606) & 0xF0F0F0F0) >> 4)) != 0x33333333)
+        return -1;
+
+    x -= 0x30303030;
+    x = ((x * 10) + (x >> 8)) & 0x00FF00FF;
+    x = ((x * 100) + (x >> 16)) & 0x0000FFFF;
+    return (int)x;
+}
+
+/* Parse the len bytes at s (a header line without its \r\n) as a signed
+ * decimal long long. Returns REDIS_ERR on empty input, stray characters or
+ * overflow, so that -1 is no longer ambiguous. */
+static int string2ll(const char *s, size_t len, long long *value) {
+    unsigned long long v = 0, limit = LLONG_MAX;
+    int negative = 0, digits;
+    size_t i;
+
+    if (len > 0 && (s[0] == '-' || s[0] == '+')) {
+        negative = (s[0] == '-');
+        limit += negative;
         s++;
+        len--;
     }
 
-    while ((c = *(s++)) != '\r') {
-        dec = c - '0';
-        if (dec >= 0 && dec < 10) {
-            v *= 10;
-            v += dec;
-        } else {
-            /* Should not happen... */
-            return -1;
-        }
+    /* Fast path: lengths and counts rarely have more than 4 digits. */
+    if (len >= 1 && len <= 4) {
+        if ((digits = parseDigits4(s,len)) < 0)
+            return REDIS_ERR;
+        *value = negative ? -(long long)digits : digits;
+        return REDIS_OK;
+    }
+
+    if (len == 0)
+        return REDIS_ERR;
+
+    for (i = 0; i < len; i++) {
+        unsigned int dec = (unsigned char)s[i] - '0';
+        if (dec > 9 || v > (limit - dec) / 10)
+            return REDIS_ERR;
+        v = v*10 + dec;
     }
 
-    return mult*v;
+    if (negative)
+        *value = (v == (unsigned long long)LLONG_MAX+1) ? LLONG_MIN : -(long long)v;
+    else
+        *value = (long long)v;
+    return REDIS_OK;
 }
 
 static char *readLine(redisReader *r, int *_len) {
@@ -190,15 +314,27 @@ static char *readLine(redisReader *r, int *_len) {
 static void moveToNextTask(redisReader *r) {
     redisReadTask *cur, *prv;
     while (r->ridx >= 0) {
+        /* A complete attribute takes no slot in its parent: the reply it
+         * annotates is read into the same task. */
+        cur = r->task[r->ridx];
+        if (cur->type == REDIS_REPLY_ATTR) {
+            cur->type = -1;
+            cur->elements = -1;
+            cur->obj = NULL;
+            if (r->ridx == r->attridx)
+                r->attridx = -1;
+            return;
+        }
+
         /* Return a.s.a.p. when the stack is now empty. */
         if (r->ridx == 0) {
             r->ridx--;
             return;
         }
 
-        cur = &(r->rstack[r->ridx]);
-        prv = &(r->rstack[r->ridx-1]);
-        assert(prv->type == REDIS_REPLY_ARRAY);
+        cur = r->task[r->ridx];
+        prv = r->task[r->ridx-1];
+        assert(REDIS_REPLY_IS_AGGREGATE(prv->type));
         if (cur->idx == prv->elements-1) {
             r->ridx--;
         } else {
@@ -212,22 +348,118 @@ static void moveToNextTask(redisReader *r) {
     }
 }
 
+/* Items inside an attribute are parsed but not built: attributes are only
+ * metadata, and are dropped once complete (see moveToNextTask). */
+static redisReplyObjectFunctions *replyFunctions(redisReader *r) {
+    return r->attridx >= 0 ? NULL : r->fn;
+}
+
+/* Parse a RESP3 double strictly: an optional sign, digits, an optional
+ * fraction and exponent, or one of "inf", "-inf" and "nan". Unlike plain
+ * strtod() this rejects whitespace, hex floats and the locale's decimal
+ * separator, and reads "." whatever the locale. */
+static int string2d(const char *s, size_t len, double *dp) {
+    char buf[REDIS_READER_MAX_DOUBLE+1], *eptr, *dot;
+    size_t i = 0, digits;
+
+    if (len == 3 && memcmp(s,"inf",3) == 0) {
+        *dp = INFINITY;
+        return REDIS_OK;
+    } else if (len == 4 && memcmp(s,"-inf",4) == 0) {
+        *dp = -INFINITY;
+        return REDIS_OK;
+    } else if (len == 3 && memcmp(s,"nan",3) == 0) {
+        *dp = NAN;
+        return REDIS_OK;
+    }
+
+    if (len == 0 || len > REDIS_READER_MAX_DOUBLE)
+        return REDIS_ERR;
+
+    if (s[i] == '-' || s[i] == '+') i++;
+    for (digits = 0; i < len && s[i] >= '0' && s[i] <= '9'; i++) digits++;
+    if (digits == 0) return REDIS_ERR;
+    if (i < len && s[i] == '.') {
+        for (i++, digits = 0; i < len && s[i] >= '0' && s[i] <= '9'; i++) digits++;
+        if (digits == 0) return REDIS_ERR;
+    }
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < len && (s[i] == '-' || s[i] == '+')) i++;
+        for (digits = 0; i < len && s[i] >= '0' && s[i] <= '9'; i++) digits++;
+        if (digits == 0) return REDIS_ERR;
+    }
+    if (i != len) return REDIS_ERR;
+
+    /* The text is now known to be a plain decimal number; strtod() only
+     * needs the locale's decimal separator in place of the dot. */
+    memcpy(buf,s,len);
+    buf[len] = '\0';
+    if ((dot = memchr(buf,'.',len)) != NULL)
+        *dot = *localeconv()->decimal_point;
+
+    errno = 0;
+    *dp = strtod(buf,&eptr);
+    if (eptr != buf+len || (errno == ERANGE && isinf(*dp)))
+        return REDIS_ERR;
+    return REDIS_OK;
+}
+
 static int processLineItem(redisReader *r) {
-    redisReadTask *cur = &(r->rstack[r->ridx]);
+    redisReadTask *cur = r->task[r->ridx];
+    redisReplyObjectFunctions *fn = replyFunctions(r);
     void *obj;
     char *p;
     int len;
 
     if ((p = readLine(r,&len)) != NULL) {
         if (cur->type == REDIS_REPLY_INTEGER) {
-            if (r->fn && r->fn->createInteger)
-                obj = r->fn->createInteger(cur,readLongLong(p));
+            long long v;
+            if (string2ll(p,len,&v) == REDIS_ERR) {
+                __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                        "Bad integer value");
+                return REDIS_ERR;
+            }
+            if (fn && fn->createInteger)
+                obj = fn->createInteger(cur,v);
             else
                 obj = (void*)REDIS_REPLY_INTEGER;
+        } else if (cur->type == REDIS_REPLY_DOUBLE) {
+            double d;
+
+            if (string2d(p,len,&d) == REDIS_ERR) {
+                __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                        "Bad double value");
+                return REDIS_ERR;
+            }
+            if (fn && fn->createDouble)
+                obj = fn->createDouble(cur,d,p,len);
+            else
+                obj = (void*)REDIS_REPLY_DOUBLE;
+        } else if (cur->type == REDIS_REPLY_BOOL) {
+            if (len != 1 || (p[0] != 't' && p[0] != 'f')) {
+                __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                        "Bad bool value");
+                return REDIS_ERR;
+            }
+            if (fn && fn->createBool)
+                obj = fn->createBool(cur,p[0] == 't');
+            else
+                obj = (void*)REDIS_REPLY_BOOL;
+        } else if (cur->type == REDIS_REPLY_NIL) {
+            if (len != 0) {
+                __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                        "Bad nil value");
+                return REDIS_ERR;
+            }
+            if (fn && fn->createNil)
+                obj = fn->createNil(cur);
+            else
+                obj = (void*)REDIS_REPLY_NIL;
         } else {
-            /* Type will be error or status. */
-            if (r->fn && r->fn->createString)
-                obj = r->fn->createString(cur,p,len);
+            /* Type will be error, status or big number. */
+            if (fn && fn->createString)
+                obj = fn->createString(cur,p,len);
             else
                 obj = (void*)(size_t)(cur->type);
         }
@@ -246,25 +478,92 @@ static int processLineItem(redisReader *r) {
     return REDIS_ERR;
 }
 
+/* Finish a large bulk string once its payload and trailing \r\n have been
+ * collected in r->bulk. The buffer is handed to the reply builder without
+ * another copy when it provides createStringNoCopy. */
+static int processLargeBulkItem(redisReader *r) {
+    redisReadTask *cur = r->task[r->ridx];
+    redisReplyObjectFunctions *fn = replyFunctions(r);
+    char *buf = r->bulk;
+    size_t len = r->bulklen;
+    void *obj;
+
+    if (r->bulkpos < len+2)
+        return REDIS_ERR;
+
+    if (buf[len] != '\r' || buf[len+1] != '\n') {
+        __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                "Bulk string not terminated by \\r\\n");
+        return REDIS_ERR;
+    }
+
+    buf[len] = '\0';
+    r->bulk = NULL;
+    r->bulklen = r->bulkpos = r->bulkcap = 0;
+    if (cur->type == REDIS_READER_BLOB_ERROR)
+        cur->type = REDIS_REPLY_ERROR;
+
+    if (fn && fn->createStringNoCopy) {
+        obj = fn->createStringNoCopy(cur,buf,len);
+        if (obj == NULL)
+            free(buf);
+    } else {
+        if (fn && fn->createString)
+            obj = fn->createString(cur,buf,len);
+        else
+            obj = (void*)(size_t)(cur->type);
+        free(buf);
+    }
+
+    if (obj == NULL) {
+        __redisReaderSetErrorOOM(r);
+        return REDIS_ERR;
+    }
+
+    /* Set reply if this is the root object. */
+    if (r->ridx == 0) r->reply = obj;
+    moveToNextTask(r);
+    return REDIS_OK;
+}
+
 static int processBulkItem(redisReader *r) {
-    redisReadTask *cur = &(r->rstack[r->ridx]);
+    redisReadTask *cur = r->task[r->ridx];
+    redisReplyObjectFunctions *fn = replyFunctions(r);
     void *obj = NULL;
     char *p, *s;
-    long len;
-    unsigned long bytelen;
+    long long len;
+    unsigned long long bytelen;
     int success = 0;
 
+    if (r->bulk != NULL)
+        return processLargeBulkItem(r);
+
     p = r->buf+r->pos;
     s = seekNewline(p,r->len-r->pos);
     if (s != NULL) {
         p = r->buf+r->pos;
         bytelen = s-(r->buf+r->pos)+2; /* include \r\n */
-        len = readLongLong(p);
+
+        if (string2ll(p,s-p,&len) == REDIS_ERR || len < -1 ||
+            (len < 0 && cur->type == REDIS_READER_BLOB_ERROR) ||
+            (len > 0 && (unsigned long long)len > SIZE_MAX-bytelen-2)) {
+            __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                    "Bad bulk string length");
+            return REDIS_ERR;
+        }
+
+        /* Verbatim strings start with a three letter format and a colon. */
+        if (cur->type == REDIS_REPLY_VERB && len >= 0 && len < 4) {
+            __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                    "Verbatim string 4 bytes of content type are "
+                    "missing or incorrectly encoded.");
+            return REDIS_ERR;
+        }
 
         if (len < 0) {
             /* The nil object can always be created. */
-            if (r->fn && r->fn->createNil)
-                obj = r->fn->createNil(cur);
+            if (fn && fn->createNil)
+                obj = fn->createNil(cur);
             else
                 obj = (void*)REDIS_REPLY_NIL;
             success = 1;
@@ -272,11 +571,30 @@ static int processBulkItem(redisReader *r) {
             /* Only continue when the buffer contains the entire bulk item. */
             bytelen += len+2; /* include \r\n */
             if (r->pos+bytelen <= r->len) {
-                if (r->fn && r->fn->createString)
-                    obj = r->fn->createString(cur,s+2,len);
+                if (cur->type == REDIS_READER_BLOB_ERROR)
+                    cur->type = REDIS_REPLY_ERROR;
+                if (fn && fn->createString)
+                    obj = fn->createString(cur,s+2,len);
                 else
-                    obj = (void*)REDIS_REPLY_STRING;
+                    obj = (void*)(size_t)(cur->type);
                 success = 1;
+            } else if (len >= REDIS_READER_DIRECT_BULK) {
+                /* Start the final buffer and move what we already have
+                 * into it. The rest of the payload is fed (or read from
+                 * the socket) straight into r->bulk, which grows with it. */
+                size_t avail = r->len-(r->pos+(s+2-p));
+                size_t cap = avail > REDIS_READER_DIRECT_BULK ?
+                             avail : REDIS_READER_DIRECT_BULK;
+
+                if ((r->bulk = malloc(cap)) == NULL) {
+                    __redisReaderSetErrorOOM(r);
+                    return REDIS_ERR;
+                }
+                memcpy(r->bulk,s+2,avail);
+                r->bulklen = len;
+                r->bulkpos = avail;
+                r->bulkcap = cap;
+                r->pos = r->len;
             }
         }
 
@@ -299,27 +617,74 @@ static int processBulkItem(redisReader *r) {
     return REDIS_ERR;
 }
 
-static int processMultiBulkItem(redisReader *r) {
-    redisReadTask *cur = &(r->rstack[r->ridx]);
+/* Make room for at least one more nested aggregate on the task stack. Tasks
+ * are allocated one by one so that parent pointers stay valid. */
+static int redisReaderGrow(redisReader *r) {
+    redisReadTask **aux;
+    int newlen;
+
+    newlen = r->tasks+REDIS_READER_STACK_SIZE;
+    aux = realloc(r->task,sizeof(*r->task)*newlen);
+    if (aux == NULL)
+        goto oom;
+
+    r->task = aux;
+    for (; r->tasks < newlen; r->tasks++) {
+        r->task[r->tasks] = calloc(1,sizeof(**r->task));
+        if (r->task[r->tasks] == NULL)
+            goto oom;
+    }
+
+    return REDIS_OK;
+oom:
+    __redisReaderSetErrorOOM(r);
+    return REDIS_ERR;
+}
+
+static int processAggregateItem(redisReader *r) {
+    redisReadTask *cur = r->task[r->ridx];
+    redisReplyObjectFunctions *fn = replyFunctions(r);
     void *obj;
     char *p;
-    long elements;
-    int root = 0;
+    long long elements;
+    int root = 0, len;
 
-    /* Set error for nested multi bulks with depth > 7 */
-    if (r->ridx == 8) {
-        __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
-            "No support for nested multi bulk replies with depth > 7");
-        return REDIS_ERR;
+    if (r->ridx == r->tasks-1) {
+        if (redisReaderGrow(r) == REDIS_ERR)
+            return REDIS_ERR;
+        cur = r->task[r->ridx];
     }
 
-    if ((p = readLine(r,NULL)) != NULL) {
-        elements = readLongLong(p);
-        root = (r->ridx == 0);
+    if ((p = readLine(r,&len)) != NULL) {
+        if (string2ll(p,len,&elements) == REDIS_ERR) {
+            __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                    "Bad multi-bulk length");
+            return REDIS_ERR;
+        }
+
+        /* Element counts are stored in an int, maps and attributes hold
+         * two elements per entry. */
+        if (cur->type == REDIS_REPLY_MAP || cur->type == REDIS_REPLY_ATTR) {
+            if (elements > INT_MAX/2) {
+                __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                        "Multi-bulk length out of range");
+                return REDIS_ERR;
+            }
+            if (elements > 0)
+                elements *= 2;
+        }
+        if (elements < -1 || elements > INT_MAX) {
+            __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                    "Multi-bulk length out of range");
+            return REDIS_ERR;
+        }
+
+        /* An attribute is never the reply itself. */
+        root = (r->ridx == 0 && cur->type != REDIS_REPLY_ATTR);
 
         if (elements == -1) {
-            if (r->fn && r->fn->createNil)
-                obj = r->fn->createNil(cur);
+            if (fn && fn->createNil)
+                obj = fn->createNil(cur);
             else
                 obj = (void*)REDIS_REPLY_NIL;
 
@@ -330,10 +695,10 @@ static int processMultiBulkItem(redisReader *r) {
 
             moveToNextTask(r);
         } else {
-            if (r->fn && r->fn->createArray)
-                obj = r->fn->createArray(cur,elements);
+            if (fn && fn->createArray)
+                obj = fn->createArray(cur,elements);
             else
-                obj = (void*)REDIS_REPLY_ARRAY;
+                obj = (void*)(size_t)(cur->type);
 
             if (obj == NULL) {
                 __redisReaderSetErrorOOM(r);
@@ -345,12 +710,12 @@ static int processMultiBulkItem(redisReader *r) {
                 cur->elements = elements;
                 cur->obj = obj;
                 r->ridx++;
-                r->rstack[r->ridx].type = -1;
-                r->rstack[r->ridx].elements = -1;
-                r->rstack[r->ridx].idx = 0;
-                r->rstack[r->ridx].obj = NULL;
-                r->rstack[r->ridx].parent = cur;
-                r->rstack[r->ridx].privdata = r->privdata;
+                r->task[r->ridx]->type = -1;
+                r->task[r->ridx]->elements = -1;
+                r->task[r->ridx]->idx = 0;
+                r->task[r->ridx]->obj = NULL;
+                r->task[r->ridx]->parent = cur;
+                r->task[r->ridx]->privdata = r->privdata;
             } else {
                 moveToNextTask(r);
             }
@@ -365,7 +730,7 @@ static int processMultiBulkItem(redisReader *r) {
 }
 
 static int processItem(redisReader *r) {
-    redisReadTask *cur = &(r->rstack[r->ridx]);
+    redisReadTask *cur = r->task[r->ridx];
     char *p;
 
     /* check if we need to read type */
@@ -387,6 +752,38 @@ static int processItem(redisReader *r) {
             case '*':
                 cur->type = REDIS_REPLY_ARRAY;
                 break;
+            case '%':
+                cur->type = REDIS_REPLY_MAP;
+                break;
+            case '~':
+                cur->type = REDIS_REPLY_SET;
+                break;
+            case '|':
+                cur->type = REDIS_REPLY_ATTR;
+                if (r->attridx < 0)
+                    r->attridx = r->ridx;
+                break;
+            case '>':
+                cur->type = REDIS_REPLY_PUSH;
+                break;
+            case ',':
+                cur->type = REDIS_REPLY_DOUBLE;
+                break;
+            case '#':
+                cur->type = REDIS_REPLY_BOOL;
+                break;
+            case '_':
+                cur->type = REDIS_REPLY_NIL;
+                break;
+            case '(':
+                cur->type = REDIS_REPLY_BIGNUM;
+                break;
+            case '=':
+                cur->type = REDIS_REPLY_VERB;
+                break;
+            case '!':
+                cur->type = REDIS_READER_BLOB_ERROR;
+                break;
             default:
                 __redisReaderSetErrorProtocolByte(r,*p);
                 return REDIS_ERR;
@@ -402,11 +799,21 @@ static int processItem(redisReader *r) {
     case REDIS_REPLY_ERROR:
     case REDIS_REPLY_STATUS:
     case REDIS_REPLY_INTEGER:
+    case REDIS_REPLY_DOUBLE:
+    case REDIS_REPLY_BOOL:
+    case REDIS_REPLY_NIL:
+    case REDIS_REPLY_BIGNUM:
         return processLineItem(r);
     case REDIS_REPLY_STRING:
+    case REDIS_REPLY_VERB:
+    case REDIS_READER_BLOB_ERROR:
         return processBulkItem(r);
     case REDIS_REPLY_ARRAY:
-        return processMultiBulkItem(r);
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_ATTR:
+    case REDIS_REPLY_PUSH:
+        return processAggregateItem(r);
     default:
         assert(NULL);
         return REDIS_ERR; /* Avoid warning. */
@@ -423,14 +830,21 @@ redisReader *redisReaderCreateWithFunctions(redisReplyObjectFunctions *fn) {
     r->err = 0;
     r->errstr[0] = '\0';
     r->fn = fn;
-    r->buf = sdsempty();
     r->maxbuf = REDIS_READER_MAX_BUF;
+    r->buf = malloc(REDIS_READER_INITIAL_BUF);
     if (r->buf == NULL) {
         free(r);
         return NULL;
     }
+    r->cap = REDIS_READER_INITIAL_BUF;
+    r->readlen = REDIS_READER_INITIAL_BUF;
 
     r->ridx = -1;
+    r->attridx = -1;
+    if (redisReaderGrow(r) == REDIS_ERR) {
+        redisReaderFree(r);
+        return NULL;
+    }
     return r;
 }
 
@@ -438,42 +852,159 @@ void redisReaderFree(redisReader *r) {
     if (r->reply != NULL && r->fn && r->fn->freeObject)
         r->fn->freeObject(r->reply);
     if (r->buf != NULL)
-        sdsfree(r->buf);
+        free(r->buf);
+    if (r->bulk != NULL)
+        free(r->bulk);
+    if (r->task != NULL) {
+        while (r->tasks > 0)
+            free(r->task[--r->tasks]);
+        free(r->task);
+    }
     free(r);
 }
 
-int redisReaderFeed(redisReader *r, const char *buf, size_t len) {
-    sds newbuf;
+/* The reader buffer is linear: data is appended at the tail, and the
+ * cursor rewinds to the front for free whenever everything was consumed.
+ * Only when the tail runs out of room are the unconsumed bytes (normally
+ * one partial item) moved: to the front when they do not overlap it and
+ * leave enough room, to a larger allocation otherwise. Unlike the old
+ * sdsrange() compaction this does not memmove on every reply, so the cost
+ * no longer depends on how many replies are queued in the buffer. */
+char *redisReaderReserve(redisReader *r, size_t len, size_t *avail) {
+    size_t pending, newcap;
+    char *newbuf;
 
     /* Return early when this reader is in an erroneous state. */
     if (r->err)
-        return REDIS_ERR;
+        return NULL;
 
-    /* Copy the provided buffer. */
-    if (buf != NULL && len >= 1) {
-        /* Destroy internal buffer when it is empty and is quite large. */
-        if (r->len == 0 && r->maxbuf != 0 && sdsavail(r->buf) > r->maxbuf) {
-            sdsfree(r->buf);
-            r->buf = sdsempty();
-            r->pos = 0;
-
-            /* r->buf should not be NULL since we just free'd a larger one. */
-            assert(r->buf != NULL);
+    /* Everything was consumed: rewind for free, and give back memory when
+     * the buffer has grown well beyond what we want to keep around. */
+    if (r->pos == r->len) {
+        r->pos = r->len = 0;
+        if (r->maxbuf != 0 && r->cap > r->maxbuf &&
+            len <= REDIS_READER_INITIAL_BUF) {
+            newbuf = realloc(r->buf,REDIS_READER_INITIAL_BUF);
+            if (newbuf != NULL) {
+                r->buf = newbuf;
+                r->cap = REDIS_READER_INITIAL_BUF;
+            }
+        }
+    }
+
+    if (r->cap-r->len < len) {
+        pending = r->len-r->pos;
+
+        if (pending <= r->pos && r->cap-pending >= len) {
+            /* Compact: the unconsumed bytes fit in front of themselves. */
+            memcpy(r->buf,r->buf+r->pos,pending);
+        } else {
+            newcap = r->cap*2;
+            if (newcap < pending+len)
+                newcap = pending+len;
+            newbuf = malloc(newcap);
+            if (newbuf == NULL) {
+                __redisReaderSetErrorOOM(r);
+                return NULL;
+            }
+            memcpy(newbuf,r->buf+r->pos,pending);
+            free(r->buf);
+            r->buf = newbuf;
+            r->cap = newcap;
         }
+        r->pos = 0;
+        r->len = pending;
+    }
+
+    if (avail != NULL)
+        *avail = r->cap-r->len;
+    return r->buf+r->len;
+}
 
-        newbuf = sdscatlen(r->buf,buf,len);
-        if (newbuf == NULL) {
+/* Make room for up to len more bytes of the pending large bulk string,
+ * doubling its buffer but never past the announced length. Returns the
+ * number of bytes that fit, 0 when the buffer could not grow. */
+static size_t bulkMakeRoom(redisReader *r, size_t len) {
+    size_t want = r->bulklen+2-r->bulkpos;
+    char *bulk;
+    size_t cap;
+
+    if (len < want) want = len;
+    if (r->bulkpos+want > r->bulkcap) {
+        cap = r->bulkcap*2;
+        if (cap < r->bulkpos+want) cap = r->bulkpos+want;
+        if (cap > r->bulklen+2) cap = r->bulklen+2;
+        if ((bulk = realloc(r->bulk,cap)) == NULL) {
             __redisReaderSetErrorOOM(r);
-            return REDIS_ERR;
+            return 0;
         }
+        r->bulk = bulk;
+        r->bulkcap = cap;
+    }
+    return want;
+}
 
-        r->buf = newbuf;
-        r->len = sdslen(r->buf);
+void redisReaderCommit(redisReader *r, size_t len) {
+    assert(r->len+len <= r->cap);
+
+    /* Callers should read into redisReaderGetBulkTarget() while a large bulk
+     * string is pending; if they did not, hand the bytes over here. Nothing
+     * else is buffered at that point, so they can simply be skipped. */
+    if (r->bulk != NULL && !r->err) {
+        size_t n = bulkMakeRoom(r,len);
+        memcpy(r->bulk+r->bulkpos,r->buf+r->len,n);
+        r->bulkpos += n;
+        r->pos += n;
+    }
+
+    r->len += len;
+}
+
+int redisReaderFeed(redisReader *r, const char *buf, size_t len) {
+    char *target;
+
+    /* Return early when this reader is in an erroneous state. */
+    if (r->err)
+        return REDIS_ERR;
+
+    /* Bytes that belong to a pending large bulk string go straight into
+     * its destination buffer. */
+    if (buf != NULL && r->bulk != NULL) {
+        size_t n = bulkMakeRoom(r,len);
+        if (r->err)
+            return REDIS_ERR;
+        memcpy(r->bulk+r->bulkpos,buf,n);
+        r->bulkpos += n;
+        buf += n;
+        len -= n;
+    }
+
+    /* Copy the provided buffer. */
+    if (buf != NULL && len >= 1) {
+        if ((target = redisReaderReserve(r,len,NULL)) == NULL)
+            return REDIS_ERR;
+        memcpy(target,buf,len);
+        redisReaderCommit(r,len);
     }
 
     return REDIS_OK;
 }
 
+size_t redisReaderGetBulkTarget(redisReader *r, char **target) {
+    if (r->err || r->bulk == NULL)
+        return 0;
+    /* Expose what is left of the buffer, growing it once it is full. */
+    if (r->bulkpos == r->bulkcap && bulkMakeRoom(r,r->bulkcap) == 0)
+        return 0;
+    *target = r->bulk+r->bulkpos;
+    return r->bulkcap-r->bulkpos;
+}
+
+void redisReaderCommitBulk(redisReader *r, size_t len) {
+    assert(r->bulk != NULL && r->bulkpos+len <= r->bulkcap);
+    r->bulkpos += len;
+}
+
 int redisReaderGetReply(redisReader *r, void **reply) {
     /* Default target pointer to NULL. */
     if (reply != NULL)
@@ -484,17 +1015,17 @@ int redisReaderGetReply(redisReader *r, void **reply) {
         return REDIS_ERR;
 
     /* When the buffer is empty, there will never be a reply. */
-    if (r->len == 0)
+    if (r->pos == r->len && r->bulk == NULL)
         return REDIS_OK;
 
     /* Set first item to process when the stack is empty. */
     if (r->ridx == -1) {
-        r->rstack[0].type = -1;
-        r->rstack[0].elements = -1;
-        r->rstack[0].idx = -1;
-        r->rstack[0].obj = NULL;
-        r->rstack[0].parent = NULL;
-        r->rstack[0].privdata = r->privdata;
+        r->task[0]->type = -1;
+        r->task[0]->elements = -1;
+        r->task[0]->idx = -1;
+        r->task[0]->obj = NULL;
+        r->task[0]->parent = NULL;
+        r->task[0]->privdata = r->privdata;
         r->ridx = 0;
     }
 
@@ -507,13 +1038,9 @@ int redisReaderGetReply(redisReader *r, void **reply) {
     if (r->err)
         return REDIS_ERR;
 
-    /* Discard part of the buffer when we've consumed at least 1k, to avoid
-     * doing unnecessary calls to memmove() in sds.c. */
-    if (r->pos >= 1024) {
-        sdsrange(r->buf,r->pos,-1);
-        r->pos = 0;
-        r->len = sdslen(r->buf);
-    }
+    /* Rewind without copying when everything buffered has been consumed. */
+    if (r->pos == r->len)
+        r->pos = r->len = 0;
 
     /* Emit a reply when there is one. */
     if (r->ridx == -1) {
@@ -53,8 +53,32 @@
 #define REDIS_REPLY_NIL 4
 #define REDIS_REPLY_STATUS 5
 #define REDIS_REPLY_ERROR 6
+#define REDIS_REPLY_DOUBLE 7
+#define REDIS_REPLY_BOOL 8
+#define REDIS_REPLY_MAP 9
+#define REDIS_REPLY_SET 10
+#define REDIS_REPLY_ATTR 11
+#define REDIS_REPLY_PUSH 12
+#define REDIS_REPLY_BIGNUM 13
+#define REDIS_REPLY_VERB 14
+
+/* Reply types whose elements are read as nested items. */
+#define REDIS_REPLY_IS_AGGREGATE(t) ((t) == REDIS_REPLY_ARRAY || \
+                                     (t) == REDIS_REPLY_MAP || \
+                                     (t) == REDIS_REPLY_SET || \
+                                     (t) == REDIS_REPLY_ATTR || \
+                                     (t) == REDIS_REPLY_PUSH)
 
 #define REDIS_READER_MAX_BUF (1024*16)  /* Default max unused reader buffer. */
+#define REDIS_READER_INITIAL_BUF (1024*16)  /* Initial reader buffer size. */
+#define REDIS_READER_MAX_READ (1024*1024)  /* Largest adaptive socket read. */
+#define REDIS_READER_STACK_SIZE 9  /* Task stack growth step. */
+
+/* Bulk strings of at least this many bytes that are not yet fully buffered
+ * are collected directly in their final allocation. That allocation starts
+ * at this size and doubles as data arrives, so a bogus length announced by
+ * the server does not reserve memory up front. */
+#define REDIS_READER_DIRECT_BULK (1024*64)
 
 #ifdef __cplusplus
 extern "C" {
@@ -62,7 +86,7 @@ extern "C" {
 
 typedef struct redisReadTask {
     int type;
-    int elements; /* number of elements in multibulk container */
+    int elements; /* number of elements in an aggregate, two per map entry */
     int idx; /* index in parent (array) object */
     void *obj; /* holds user-generated value for a read task */
     struct redisReadTask *parent; /* parent task */
@@ -75,19 +99,36 @@ typedef struct redisReplyObjectFunctions {
     void *(*createInteger)(const redisReadTask*, long long);
     void *(*createNil)(const redisReadTask*);
     void (*freeObject)(void*);
+    /* Members below were added after freeObject; initializers that stop
+     * early leave them NULL. */
+    /* RESP3 scalars; the double also gets its textual form. */
+    void *(*createDouble)(const redisReadTask*, double, char*, size_t);
+    void *(*createBool)(const redisReadTask*, int);
+    /* Optional: like createString, but takes ownership of a malloc'ed,
+     * NUL-terminated buffer instead of copying it. */
+    void *(*createStringNoCopy)(const redisReadTask*, char*, size_t);
 } redisReplyObjectFunctions;
 
 typedef struct redisReader {
     int err; /* Error flags, 0 when there is no error */
     char errstr[128]; /* String representation of error when applicable */
 
-    char *buf; /* Read buffer */
+    char *buf; /* Read buffer, compacted when full (see redisReaderReserve) */
     size_t pos; /* Buffer cursor */
     size_t len; /* Buffer length */
+    size_t cap; /* Buffer capacity */
     size_t maxbuf; /* Max length of unused buffer */
+    size_t readlen; /* Adaptive socket read size, see redisBufferRead */
+
+    char *bulk; /* Final buffer of a large bulk string being read */
+    size_t bulklen; /* Payload length of that bulk string */
+    size_t bulkpos; /* Bytes of payload and trailing \r\n received */
+    size_t bulkcap; /* Bytes allocated for bulk, grows as data arrives */
 
-    redisReadTask rstack[9];
+    redisReadTask **task; /* Task stack, grows with the nesting depth */
+    int tasks; /* Number of allocated tasks */
     int ridx; /* Index of current read task */
+    int attridx; /* Index of the outermost attribute being read, or -1 */
     void *reply; /* Temporary reply pointer */
 
     redisReplyObjectFunctions *fn;
@@ -98,8 +139,22 @@ typedef struct redisReader {
 redisReader *redisReaderCreateWithFunctions(redisReplyObjectFunctions *fn);
 void redisReaderFree(redisReader *r);
 int redisReaderFeed(redisReader *r, const char *buf, size_t len);
+
+/* Zero-copy alternative to redisReaderFeed: reserve at least len bytes of
+ * contiguous free space in the reader buffer, read into it, then commit the
+ * number of bytes actually written. The pointer is only valid until the next
+ * call into the reader. Returns NULL on error; *avail receives the total
+ * free space, which may exceed len. */
+char *redisReaderReserve(redisReader *r, size_t len, size_t *avail);
+void redisReaderCommit(redisReader *r, size_t len);
 int redisReaderGetReply(redisReader *r, void **reply);
 
+/* While a large bulk string is pending, expose the unfilled part of its
+ * buffer so that I/O code can read into it directly, then account for the
+ * bytes written there. Returns 0 when there is no pending bulk string. */
+size_t redisReaderGetBulkTarget(redisReader *r, char **target);
+void redisReaderCommitBulk(redisReader *r, size_t len);
+
 /* Backwards compatibility, can be removed on big version bump. */
 #define redisReplyReaderCreate redisReaderCreate
 #define redisReplyReaderFree redisReaderFree
@@ -0,0 +1,216 @@
+#include "fmacros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* dict.c is only compiled into async.c, its functions are static */
+#include "dict.c"
+
+/*
+ * Tests for the open addressing dict: insert, delete, replace, lookup and
+ * iteration while a table is being rehashed incrementally, with a good hash
+ * and with one that puts every key into a handful of long probe runs.
+ *
+ * usage: test_dict
+ */
+
+#define check(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr,"%s:%d: check failed: %s\n",__FILE__,__LINE__,#cond); \
+        exit(1); \
+    } \
+} while(0)
+
+#define NKEYS 5000
+
+static uint64_t stringHash(const void *key) {
+    return dictGenHashFunction(key,strlen(key));
+}
+
+/* Keys land in the last 8 slots only, so probe runs wrap around the end
+ * of the table and overlap. */
+static uint64_t clusteredHash(const void *key) {
+    return ~(stringHash(key) & 7);
+}
+
+static int stringCompare(void *privdata, const void *key1, const void *key2) {
+    DICT_NOTUSED(privdata);
+    return strcmp(key1,key2) == 0;
+}
+
+static void stringFree(void *privdata, void *key) {
+    DICT_NOTUSED(privdata);
+    free(key);
+}
+
+static dictType stringType = {
+    stringHash, NULL, NULL, stringCompare, stringFree, NULL
+};
+
+static dictType clusteredType = {
+    clusteredHash, NULL, NULL, stringCompare, stringFree, NULL
+};
+
+static char *keyName(long i) {
+    static char buf[32];
+    snprintf(buf,sizeof(buf),"key:%ld",i);
+    return buf;
+}
+
+static void add(dict *d, long i) {
+    check(dictAdd(d,strdup(keyName(i)),(void*)(i+1)) == DICT_OK);
+}
+
+/* Checks that exactly the keys i in [0,n) with present[i] set are found,
+ * with their values. Leaves the rehash where it was. */
+static void checkContents(dict *d, const char *present, long n) {
+    long rehashidx = d->rehashidx, i, size = 0;
+    dictEntry *de;
+
+    d->iterators++;
+    for (i = 0; i < n; i++) {
+        de = dictFind(d,keyName(i));
+        check((de != NULL) == (present[i] != 0));
+        if (de != NULL) {
+            check(dictGetEntryVal(de) == (void*)(i+1));
+            size++;
+        }
+    }
+    d->iterators--;
+    check(d->rehashidx == rehashidx);
+    check((long)dictSize(d) == size);
+}
+
+/* Returns how many times the dict was seen rehashing while it grew. */
+static long testInsert(dictType *type, long n) {
+    dict *d = dictCreate(type,NULL);
+    char present[NKEYS] = {0};
+    long i, rehashing = 0;
+
+    for (i = 0; i < n; i++) {
+        add(d,i);
+        present[i] = 1;
+        check(dictAdd(d,keyName(i),NULL) == DICT_ERR);
+        if (dictIsRehashing(d)) {
+            check(d->ht[0].size > 0 && d->ht[1].size == 2*d->ht[0].size);
+            if (rehashing++ % 64 == 0)
+                checkContents(d,present,i+1);
+        }
+    }
+    checkContents(d,present,n);
+    dictRelease(d);
+    check(rehashing > 0);
+    return rehashing;
+}
+
+static void testDelete(dictType *type) {
+    dict *d = dictCreate(type,NULL);
+    char present[NKEYS] = {0};
+    long i, n = 0, deleted = 0;
+
+    /* Grow until a rehash starts, then delete every other key while it
+     * runs, and every third key of what was added since. */
+    while (!dictIsRehashing(d) || d->ht[0].used < 64) {
+        add(d,n);
+        present[n++] = 1;
+    }
+    check(dictIsRehashing(d));
+    for (i = 0; i < n && dictIsRehashing(d); i += 2) {
+        check(dictDelete(d,keyName(i)) == DICT_OK);
+        check(dictDelete(d,keyName(i)) == DICT_ERR);
+        present[i] = 0;
+        deleted++;
+        checkContents(d,present,n);
+    }
+    check(deleted > 1);
+    for (i = 0; i < n; i += 3) {
+        if (present[i]) {
+            check(dictDelete(d,keyName(i)) == DICT_OK);
+            present[i] = 0;
+        }
+    }
+    checkContents(d,present,n);
+
+    /* Deleting everything leaves an empty, usable dict. */
+    for (i = 0; i < n; i++) {
+        if (present[i]) {
+            check(dictDelete(d,keyName(i)) == DICT_OK);
+            present[i] = 0;
+        }
+    }
+    check(dictSize(d) == 0 && dictFind(d,keyName(0)) == NULL);
+    add(d,0);
+    present[0] = 1;
+    checkContents(d,present,n);
+    dictRelease(d);
+}
+
+static void testReplace(dictType *type) {
+    dict *d = dictCreate(type,NULL);
+    char *key;
+    long i, n = 0;
+
+    while (!dictIsRehashing(d) || d->ht[0].used < 32)
+        add(d,n++);
+    for (i = 0; i < n; i++) {
+        key = strdup(keyName(i));
+        check(dictReplace(d,key,(void*)(i+1000)) == 0);
+        free(key); /* the dict kept its own copy of the key */
+    }
+    for (i = 0; i < n; i++)
+        check(dictGetEntryVal(dictFind(d,keyName(i))) == (void*)(i+1000));
+    check(dictReplace(d,strdup(keyName(n)),(void*)1) == 1);
+    check((long)dictSize(d) == n+1);
+    dictRelease(d);
+}
+
+static void testIterate(dictType *type) {
+    dict *d = dictCreate(type,NULL);
+    char seen[NKEYS];
+    dictIterator *it;
+    dictEntry *de;
+    long rehashidx, i, n = 0, count = 0;
+
+    while (!dictIsRehashing(d) || d->ht[0].used < 64)
+        add(d,n++);
+
+    /* Every entry is returned once, from either table, and lookups made
+     * while the iterator exists do not move entries under it. */
+    memset(seen,0,sizeof(seen));
+    rehashidx = d->rehashidx;
+    it = dictGetIterator(d);
+    while ((de = dictNext(it)) != NULL) {
+        i = (long)dictGetEntryVal(de)-1;
+        check(i >= 0 && i < n && !seen[i]);
+        check(strcmp(dictGetEntryKey(de),keyName(i)) == 0);
+        seen[i] = 1;
+        count++;
+        check(dictFind(d,keyName((i*7)%n)) != NULL);
+        check(d->rehashidx == rehashidx);
+    }
+    dictReleaseIterator(it);
+    check(count == n && (long)dictSize(d) == n);
+
+    /* Once released, lookups finish the rehash. */
+    while (dictIsRehashing(d))
+        check(dictFind(d,keyName(0)) != NULL);
+    check(d->ht[1].size == 0 && (long)d->ht[0].used == n);
+    dictRelease(d);
+}
+
+int main(void) {
+    dictType *types[] = { &stringType, &clusteredType };
+    const char *names[] = { "murmur", "clustered" };
+    long keys[] = { NKEYS, NKEYS/10 };
+    long rehashing;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        rehashing = testInsert(types[i],keys[i]);
+        testDelete(types[i]);
+        testReplace(types[i]);
+        testIterate(types[i]);
+        printf("%s: ok (%ld inserts during a rehash)\n",names[i],rehashing);
+    }
+    return 0;
+}
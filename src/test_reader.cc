@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hiredis.h"
+
+/*
+ * Tests for the RESP reader, through redisReaderFeed()/redisReaderGetReply()
+ * and through a socket: replies are fed whole and in pieces, and must come
+ * out the same.
+ *
+ * usage: test_reader
+ */
+
+#define check(cond) do { \
+	if(!(cond)) { \
+		std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		std::exit(1); \
+	} \
+} while(0)
+
+/* one line per reply, enough to tell two parses apart */
+static std::string describe(const redisReply *r) {
+	std::string s = std::to_string(r->type) + ":";
+	if(REDIS_REPLY_IS_AGGREGATE(r->type)) {
+		s += std::to_string(r->elements) + "[";
+		for(size_t i=0; i<r->elements; i++) s += describe(r->element[i]) + ",";
+		return s + "]";
+	}
+	switch(r->type) {
+		case REDIS_REPLY_INTEGER:
+		case REDIS_REPLY_BOOL: return s + std::to_string(r->integer);
+		case REDIS_REPLY_NIL: return s;
+		case REDIS_REPLY_VERB: return s + r->vtype + ":" + std::string(r->str, r->len);
+		default: return s + std::string(r->str, r->len);
+	}
+}
+
+struct Parse {
+	std::vector<std::string> replies;
+	std::string error;
+};
+
+/* feeds data in pieces split at the given offsets, collecting replies as
+ * soon as they are complete */
+static Parse parse(const std::string& data, const std::vector<size_t>& splits) {
+	redisReader *reader = redisReaderCreate();
+	Parse result;
+	size_t from = 0;
+
+	for(size_t i=0; i<=splits.size(); i++) {
+		size_t to = i < splits.size() ? splits[i] : data.size();
+		if(redisReaderFeed(reader, data.data() + from, to - from) != REDIS_OK) break;
+		from = to;
+
+		void *reply;
+		while(redisReaderGetReply(reader, &reply) == REDIS_OK && reply != NULL) {
+			result.replies.push_back(describe((redisReply*)reply));
+			freeReplyObject(reply);
+		}
+		if(reader->err) {
+			result.error = reader->errstr;
+			break;
+		}
+	}
+
+	redisReaderFree(reader);
+	return result;
+}
+
+static Parse parse(const std::string& data) {
+	return parse(data, {});
+}
+
+static std::string status(const std::string& s) {
+	return std::to_string(REDIS_REPLY_STATUS) + ":" + s;
+}
+
+/* The CRLF scan works on 16 and 32 byte blocks that look one byte ahead,
+ * then finishes with narrower code: put the line end, and lone \r and \n
+ * bytes, on every position around those block edges, at several alignments
+ * in the buffer, and split the feed between \r and \n. */
+static void testLineEnds() {
+	for(size_t prefix=0; prefix<4; prefix++) {
+		std::string head;
+		for(size_t i=0; i<prefix; i++) head += "+\r\n";
+
+		for(size_t n=0; n<=100; n++) {
+			std::string text(n, 'x');
+			std::string data = head + "+" + text + "\r\n";
+			Parse p = parse(data);
+			check(p.error.empty() && p.replies.size() == prefix + 1 && p.replies.back() == status(text));
+
+			p = parse(data, {data.size() - 1});
+			check(p.error.empty() && p.replies.size() == prefix + 1 && p.replies.back() == status(text));
+
+			for(size_t at=0; at<n; at++) {
+				for(char decoy : {'\r', '\n'}) {
+					std::string odd = text;
+					odd[at] = decoy;
+					p = parse(head + "+" + odd + "\r\n");
+					check(p.error.empty() && p.replies.back() == status(odd));
+				}
+			}
+		}
+	}
+
+	/* a \r that ends one feed and a \n that starts the next still end the
+	 * line, a \r followed by anything else does not */
+	Parse p = parse("+" + std::string(40, 'y') + "\r\r\n", {41});
+	check(p.replies.size() == 1 && p.replies[0] == status(std::string(40, 'y') + "\r"));
+	p = parse("+" + std::string(40, 'y') + "\r", {});
+	check(p.error.empty() && p.replies.empty());
+}
+
+static std::string integer(long long v) {
+	return std::to_string(REDIS_REPLY_INTEGER) + ":" + std::to_string(v);
+}
+
+static void expectReply(const std::string& data, const std::string& expected) {
+	Parse p = parse(data);
+	check(p.error.empty() && p.replies.size() == 1 && p.replies[0] == expected);
+}
+
+static void expectError(const std::string& data, const std::string& error) {
+	Parse p = parse(data);
+	check(p.replies.empty() && p.error == error);
+}
+
+/* Integers take a fast path up to 4 digits and a checked loop beyond, so
+ * test both sides of that and of the 64 bit limits; lengths and counts
+ * must reject what does not fit instead of wrapping around. */
+static void testNumbers() {
+	expectReply(":0\r\n", integer(0));
+	expectReply(":-0\r\n", integer(0));
+	expectReply(":+7\r\n", integer(7));
+	expectReply(":0001\r\n", integer(1));
+	expectReply(":-9999\r\n", integer(-9999));
+	expectReply(":10000\r\n", integer(10000));
+	expectReply(":9223372036854775807\r\n", integer(9223372036854775807LL));
+	expectReply(":-9223372036854775808\r\n", integer(-9223372036854775807LL - 1));
+	for(const char *bad : {":\r\n", ":-\r\n", ":+\r\n", ":--1\r\n", ":1a\r\n", ":12345x\r\n",
+			":1 \r\n", ": 1\r\n", ":9223372036854775808\r\n", ":-9223372036854775809\r\n",
+			":99999999999999999999\r\n"})
+		expectError(bad, "Bad integer value");
+
+	expectReply("$-1\r\n", std::to_string(REDIS_REPLY_NIL) + ":");
+	expectReply("$0\r\n\r\n", std::to_string(REDIS_REPLY_STRING) + ":");
+	for(const char *bad : {"$-2\r\n", "$-9223372036854775808\r\n", "$\r\n", "$1x\r\n",
+			"$18446744073709551615\r\n", "$99999999999999999999\r\n"})
+		expectError(bad, "Bad bulk string length");
+
+	/* a length the server could never send is not allocated up front */
+	redisReader *reader = redisReaderCreate();
+	void *reply;
+	std::string huge = "$9223372036854775000\r\n" + std::string(100000, 'z');
+	check(redisReaderFeed(reader, huge.data(), huge.size()) == REDIS_OK);
+	check(redisReaderGetReply(reader, &reply) == REDIS_OK && reply == NULL);
+	check(reader->bulkcap < 1024 * 1024);
+	redisReaderFree(reader);
+
+	expectReply("*-1\r\n", std::to_string(REDIS_REPLY_NIL) + ":");
+	expectReply("*0\r\n", std::to_string(REDIS_REPLY_ARRAY) + ":0[]");
+	for(const char *bad : {"*\r\n", "*1x\r\n", "*99999999999999999999\r\n"})
+		expectError(bad, "Bad multi-bulk length");
+	for(const char *bad : {"*-2\r\n", "*2147483648\r\n", "%1073741824\r\n", "*-9223372036854775808\r\n"})
+		expectError(bad, "Multi-bulk length out of range");
+}
+
+static std::string bulk(const std::string& s) {
+	return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+/* Every kind of reply, with bulk strings on both sides of
+ * REDIS_READER_DIRECT_BULK, so that splits land inside headers, payloads,
+ * line ends and nested aggregates. */
+static std::string corpus(size_t *replies) {
+	std::string data;
+	std::string large(REDIS_READER_DIRECT_BULK + 1000, 'L');
+	for(size_t i=0; i<large.size(); i+=61) large[i] = '\r';
+
+	data += "+OK\r\n";
+	data += "-ERR something\r\n";
+	data += ":12345678901\r\n";
+	data += bulk("hello") + bulk("") + "$-1\r\n";
+	data += bulk(std::string(REDIS_READER_DIRECT_BULK - 1, 's'));
+	data += bulk(large);
+	data += "*3\r\n:1\r\n*2\r\n" + bulk("a") + bulk(large) + "+x\r\n";
+	data += "*0\r\n*-1\r\n";
+	data += ",3.25\r\n,-inf\r\n#t\r\n#f\r\n_\r\n(123456789012345678901234567890\r\n";
+	data += "=9\r\ntxt:hello\r\n";
+	data += "%2\r\n+k1\r\n:1\r\n+k2\r\n~2\r\n:1\r\n:2\r\n";
+	data += "|1\r\n+ttl\r\n:100\r\n" + bulk("annotated");
+	data += ">3\r\n+message\r\n+chan\r\n" + bulk("payload");
+	data += "!5\r\nERR x\r\n";
+	*replies = 22;
+	return data;
+}
+
+/* Replies split across feeds of every small size, around the reader's
+ * buffer sizes and at random points must parse exactly like the whole. */
+static void testSplits() {
+	size_t replies;
+	std::string data = corpus(&replies);
+	Parse whole = parse(data);
+	check(whole.error.empty() && whole.replies.size() == replies);
+
+	std::vector<size_t> chunks;
+	for(size_t c=1; c<=40; c++) chunks.push_back(c);
+	for(int c : {1000, 4095, 4096, 4097, REDIS_READER_INITIAL_BUF - 1, REDIS_READER_INITIAL_BUF,
+			REDIS_READER_INITIAL_BUF + 1, REDIS_READER_DIRECT_BULK, REDIS_READER_DIRECT_BULK + 7})
+		chunks.push_back(c);
+
+	for(size_t chunk : chunks) {
+		std::vector<size_t> splits;
+		for(size_t off=chunk; off<data.size(); off+=chunk) splits.push_back(off);
+		Parse p = parse(data, splits);
+		check(p.error.empty() && p.replies == whole.replies);
+	}
+
+	std::srand(42);
+	for(int round=0; round<200; round++) {
+		std::vector<size_t> splits;
+		for(size_t off=std::rand() % 300 + 1; off<data.size(); off+=std::rand() % 20000 + 1) splits.push_back(off);
+		Parse p = parse(data, splits);
+		check(p.error.empty() && p.replies == whole.replies);
+	}
+}
+
+/* When its tail runs out of room the buffer either compacts or grows;
+ * both must keep a partial reply intact, and the buffer shrinks back once
+ * drained. */
+static void testCompaction() {
+	redisReader *reader = redisReaderCreate();
+	std::string line = "+" + std::string(1000, 'c') + "\r\n";
+	std::string data;
+	void *reply;
+	size_t got = 0;
+
+	for(int i=0; i<200; i++) data += line;
+	for(size_t off=0; off<data.size(); off+=1500) {
+		size_t len = std::min<size_t>(1500, data.size() - off);
+		check(redisReaderFeed(reader, data.data() + off, len) == REDIS_OK);
+		while(redisReaderGetReply(reader, &reply) == REDIS_OK && reply != NULL) {
+			check(describe((redisReply*)reply) == status(line.substr(1, 1000)));
+			freeReplyObject(reply);
+			got++;
+		}
+	}
+	check(got == 200 && reader->cap == REDIS_READER_INITIAL_BUF);
+
+	/* one reply larger than the buffer, fed without draining */
+	std::string big = bulk(std::string(REDIS_READER_INITIAL_BUF * 3, 'g'));
+	check(redisReaderFeed(reader, "+a\r\n", 4) == REDIS_OK);
+	for(size_t off=0; off<big.size(); off+=5000)
+		check(redisReaderFeed(reader, big.data() + off, std::min<size_t>(5000, big.size() - off)) == REDIS_OK);
+	check(redisReaderGetReply(reader, &reply) == REDIS_OK && reply != NULL);
+	check(describe((redisReply*)reply) == status("a"));
+	freeReplyObject(reply);
+	check(redisReaderGetReply(reader, &reply) == REDIS_OK && reply != NULL);
+	check(((redisReply*)reply)->len == REDIS_READER_INITIAL_BUF * 3);
+	freeReplyObject(reply);
+	check(redisReaderFeed(reader, "+b\r\n", 4) == REDIS_OK);
+	check(reader->cap == REDIS_READER_INITIAL_BUF);
+	redisReaderFree(reader);
+}
+
+/* writes data to fd in pieces of piece bytes, or as one write if 0 */
+static void writeAll(int fd, const std::string& data, size_t piece) {
+	for(size_t off=0; off<data.size(); ) {
+		size_t len = piece == 0 ? data.size() - off : std::min(piece, data.size() - off);
+		ssize_t n = write(fd, data.data() + off, len);
+		check(n > 0);
+		off += n;
+	}
+}
+
+/* Through redisBufferRead(): the rest of a large bulk string is read
+ * straight into its own buffer, with what follows it landing in the
+ * reader buffer in the same readv(), and the read size adapts to how much
+ * the socket delivers. */
+static void testSocket() {
+	size_t replies;
+	std::string data = corpus(&replies);
+	Parse whole = parse(data);
+	int fds[2];
+
+	check(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	redisContext *c = redisConnectFd(fds[0]);
+	check(c != NULL && c->err == 0);
+
+	for(size_t piece : {0, 1, 7, 1000, REDIS_READER_INITIAL_BUF + 3, REDIS_READER_DIRECT_BULK + 5}) {
+		std::thread writer(writeAll, fds[1], data, piece);
+		for(size_t i=0; i<replies; i++) {
+			void *reply;
+			check(redisGetReply(c, &reply) == REDIS_OK && reply != NULL);
+			check(describe((redisReply*)reply) == whole.replies[i]);
+			freeReplyObject(reply);
+		}
+		writer.join();
+		check(c->reader->bulk == NULL && c->reader->pos == c->reader->len);
+	}
+
+	/* full reads double the read size up to REDIS_READER_MAX_READ, a
+	 * short one resets it */
+	std::string burst;
+	while(burst.size() < 4 * REDIS_READER_MAX_READ) burst += "+" + std::string(100, 'b') + "\r\n";
+	std::thread writer(writeAll, fds[1], burst, 0);
+	size_t grown = 0;
+	for(size_t off=0; off<burst.size(); off+=103) {
+		void *reply;
+		check(redisGetReply(c, &reply) == REDIS_OK && reply != NULL);
+		freeReplyObject(reply);
+		grown = std::max(grown, c->reader->readlen);
+	}
+	writer.join();
+	check(grown > REDIS_READER_INITIAL_BUF && grown <= REDIS_READER_MAX_READ);
+
+	void *reply;
+	writeAll(fds[1], "+x\r\n", 0);
+	check(redisGetReply(c, &reply) == REDIS_OK && reply != NULL);
+	freeReplyObject(reply);
+	check(c->reader->readlen == REDIS_READER_INITIAL_BUF);
+
+	redisFree(c);
+	close(fds[1]);
+}
+
+int main() {
+	testLineEnds();
+	testNumbers();
+	testSplits();
+	testCompaction();
+	testSocket();
+	std::printf("reader: ok\n");
+	return 0;
+}
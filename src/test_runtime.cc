@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hiredis.h"
+#include "RedisRuntime.h"
+#include "SpscQueue.h"
+
+/*
+ * Tests for the SPSC queue and for the RedisRuntime submission paths,
+ * against a small echo server run by the test itself: many producers,
+ * beyond those with a queue of their own; a connection taken over by an
+ * idle loop while its replies are held back; and the failure of a command
+ * submitted to a full queue.
+ *
+ * usage: test_runtime
+ */
+
+#define check(cond) do { \
+	if(!(cond)) { \
+		std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		std::exit(1); \
+	} \
+} while(0)
+
+using YiCppLib::RedisRuntime;
+using YiCppLib::SpscQueue;
+
+/* waits up to 10s for done() */
+template<typename Done>
+static bool eventually(Done done) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while(!done()) {
+		if(std::chrono::steady_clock::now() > deadline) return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+/* answers ECHO with its argument and anything else with +OK, in order;
+ * while hold is set, replies are kept until it is cleared */
+class Server {
+	public:
+		std::atomic<bool> hold{false};
+		int port = 0;
+
+		Server() {
+			listenFd = socket(AF_INET, SOCK_STREAM, 0);
+			check(listenFd != -1);
+			struct sockaddr_in sa = {};
+			sa.sin_family = AF_INET;
+			sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			check(bind(listenFd, (struct sockaddr*)&sa, sizeof(sa)) == 0);
+			check(listen(listenFd, 64) == 0);
+			socklen_t len = sizeof(sa);
+			check(getsockname(listenFd, (struct sockaddr*)&sa, &len) == 0);
+			port = ntohs(sa.sin_port);
+			thread = std::thread([this] { loop(); });
+		}
+
+		~Server() {
+			stopping.store(true);
+			thread.join();
+			for(auto& client : clients) {
+				close(client.fd);
+				redisReaderFree(client.reader);
+			}
+			close(listenFd);
+		}
+
+	private:
+		struct Client {
+			int fd;
+			redisReader *reader;
+			std::string held;
+		};
+
+		std::vector<Client> clients;
+		int listenFd = -1;
+		std::atomic<bool> stopping{false};
+		std::thread thread;
+
+		static void send(int fd, const std::string& data) {
+			for(size_t done=0; done<data.size();) {
+				ssize_t n = write(fd, data.data() + done, data.size() - done);
+				if(n <= 0) return;	// the client is gone, its read will tell
+				done += n;
+			}
+		}
+
+		void loop() {
+			while(!stopping.load()) {
+				if(!hold.load()) {
+					for(auto& client : clients) {
+						send(client.fd, client.held);
+						client.held.clear();
+					}
+				}
+
+				std::vector<struct pollfd> fds;
+				size_t served = clients.size();
+				for(auto& client : clients) fds.push_back({client.fd, POLLIN, 0});
+				fds.push_back({listenFd, POLLIN, 0});
+				if(poll(fds.data(), fds.size(), 1) <= 0) continue;
+
+				if(fds.back().revents != 0) {
+					int fd = accept(listenFd, nullptr, nullptr);
+					if(fd != -1) clients.push_back(Client{fd, redisReaderCreate(), ""});
+				}
+				for(size_t i=served; i-- > 0;)
+					if(fds[i].revents != 0) serve(i);
+			}
+		}
+
+		void serve(size_t i) {
+			char buf[16384];
+			Client& client = clients[i];
+			ssize_t n = read(client.fd, buf, sizeof(buf));
+			if(n <= 0) {
+				close(client.fd);
+				redisReaderFree(client.reader);
+				clients.erase(clients.begin() + i);
+				return;
+			}
+
+			redisReaderFeed(client.reader, buf, n);
+			void *reply;
+			std::string out;
+			while(redisReaderGetReply(client.reader, &reply) == REDIS_OK && reply != nullptr) {
+				redisReply *r = static_cast<redisReply*>(reply);
+				std::string name(r->element[0]->str, r->element[0]->len);
+				std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+				if(name == "echo" && r->elements == 2)
+					out += "$" + std::to_string(r->element[1]->len) + "\r\n" + std::string(r->element[1]->str, r->element[1]->len) + "\r\n";
+				else out += "+OK\r\n";
+				freeReplyObject(r);
+			}
+			client.held += out;
+			if(!hold.load()) {
+				send(client.fd, client.held);
+				client.held.clear();
+			}
+		}
+};
+
+static RedisRuntime::Options runtimeOptions(size_t threads) {
+	RedisRuntime::Options options;
+	options.threads = threads;
+	options.pinThreads = false;
+	return options;
+}
+
+static std::string str(const redisReply *reply) {
+	return std::string(reply->str, reply->len);
+}
+
+/* one producer, one consumer, many times around a small ring */
+static void testSpscQueue() {
+	check(SpscQueue<int>(5).capacity() == 8);
+	check(SpscQueue<int>(1).capacity() == 2);
+
+	SpscQueue<int> full(4);
+	for(int i=0; i<4; i++) check(full.tryPush(int(i)));
+	check(!full.tryPush(4));
+	int value;
+	check(full.tryPop(value) && value == 0);
+	check(full.tryPush(4));
+	for(int i=1; i<=4; i++) check(full.tryPop(value) && value == i);
+	check(!full.tryPop(value) && full.empty());
+
+	const int n = 1000000;
+	SpscQueue<int> queue(64);
+	std::thread producer([&] {
+		for(int i=0; i<n; i++)
+			while(!queue.tryPush(int(i))) std::this_thread::yield();
+	});
+	for(int i=0; i<n; i++) {
+		while(!queue.tryPop(value)) std::this_thread::yield();
+		check(value == i);
+	}
+	producer.join();
+	check(queue.empty());
+}
+
+/* more submitting threads than there are SPSC slots, so the last ones go
+ * through the locked overflow queue; every reply comes once, in the order
+ * its thread submitted */
+static void testProducers(int port) {
+	const size_t producers = 80, perProducer = 200;
+	RedisRuntime runtime("127.0.0.1", port, runtimeOptions(2));
+	std::vector<std::atomic<size_t>> next(producers);
+	std::atomic<size_t> replies{0}, misordered{0};
+	for(auto& n : next) n.store(0);
+
+	std::vector<std::thread> threads;
+	for(size_t p=0; p<producers; p++) {
+		threads.emplace_back([&, p] {
+			for(size_t i=0; i<perProducer; i++) {
+				runtime.command(0, {"ECHO", std::to_string(p) + ":" + std::to_string(i)}, [&, p, i](redisReply *reply) {
+					if(reply == nullptr || str(reply) != std::to_string(p) + ":" + std::to_string(i) || next[p].fetch_add(1) != i)
+						misordered++;
+					replies++;
+				});
+			}
+		});
+	}
+	for(auto& thread : threads) thread.join();
+
+	check(eventually([&] { return replies.load() == producers * perProducer; }));
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	check(replies.load() == producers * perProducer);
+	check(misordered.load() == 0);
+}
+
+/* loop 0 owns shards 0 and 1 and has a backlog on both, held back by the
+ * server; loop 1 owns shard 2 and is idle, so it takes over one of them.
+ * Commands queued before and after the handoff are answered in order */
+static void testHandoff(Server& server) {
+	const size_t perShard = 400;
+	RedisRuntime::Options options = runtimeOptions(2);
+	options.stealThreshold = 16;
+	options.idleCheck = std::chrono::milliseconds(1);
+	RedisRuntime runtime("127.0.0.1", server.port, options);
+	check(runtime.connections() == 4);
+
+	std::mutex mutex;
+	std::thread::id owners[3];
+	for(size_t shard=0; shard<3; shard++) {
+		std::atomic<bool> done{false};
+		runtime.command(shard, {"PING"}, [&, shard](redisReply *reply) {
+			check(reply != nullptr);
+			owners[shard] = std::this_thread::get_id();
+			done = true;
+		});
+		check(eventually([&] { return done.load(); }));
+	}
+	check(owners[0] == owners[1] && owners[0] != owners[2]);
+
+	std::atomic<size_t> next[2], replies{0}, misordered{0}, moved{0};
+	for(auto& n : next) n.store(0);
+	auto submit = [&](size_t from, size_t to) {
+		for(size_t i=from; i<to; i++)
+			for(size_t shard=0; shard<2; shard++)
+				runtime.command(shard, {"ECHO", std::to_string(i)}, [&, shard, i](redisReply *reply) {
+					if(reply == nullptr || str(reply) != std::to_string(i) || next[shard].fetch_add(1) != i)
+						misordered++;
+					std::lock_guard<std::mutex> lock(mutex);
+					if(std::this_thread::get_id() == owners[2]) moved++;
+					replies++;
+				});
+	};
+
+	server.hold.store(true);
+	submit(0, perShard / 2);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	submit(perShard / 2, perShard);
+	server.hold.store(false);
+
+	check(eventually([&] { return replies.load() == 2 * perShard; }));
+	check(misordered.load() == 0);
+	check(moved.load() >= perShard / 2);
+}
+
+/* a callback that submits more than queueSize commands to its own
+ * connection: the loop cannot drain meanwhile, so the excess fails at once,
+ * on the calling thread, and each callback still runs exactly once */
+static void testQueueFull(int port) {
+	const size_t submitted = 10;
+	RedisRuntime::Options options = runtimeOptions(1);
+	options.queueSize = 4;
+	RedisRuntime runtime("127.0.0.1", port, options);
+
+	std::vector<std::atomic<int>> calls(submitted);
+	std::atomic<size_t> failed{0}, failedAtOnce{0}, answered{0};
+	std::atomic<bool> done{false};
+	for(auto& n : calls) n.store(0);
+
+	runtime.command(0, {"PING"}, [&](redisReply *) {
+		auto self = std::this_thread::get_id();
+		for(size_t i=0; i<submitted; i++) {
+			runtime.command(0, {"ECHO", std::to_string(i)}, [&, i, self](redisReply *reply) {
+				calls[i]++;
+				if(reply == nullptr) {
+					failed++;
+					if(std::this_thread::get_id() == self && !done.load()) failedAtOnce++;
+				}
+				else if(str(reply) == std::to_string(i)) answered++;
+			});
+		}
+		done = true;
+	});
+
+	check(eventually([&] { return failed.load() + answered.load() == submitted; }));
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	for(auto& n : calls) check(n.load() == 1);
+	check(answered.load() == 4);
+	check(failed.load() == submitted - 4 && failedAtOnce.load() == failed.load());
+}
+
+int main() {
+	testSpscQueue();
+	std::printf("spsc queue: ok\n");
+
+	Server server;
+	testProducers(server.port);
+	std::printf("producers: ok\n");
+	testHandoff(server);
+	std::printf("handoff: ok\n");
+	testQueueFull(server.port);
+	std::printf("queue full: ok\n");
+	return 0;
+}
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fnmatch.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hiredis.h"
+#include "RedisKVStore.h"
+
+/*
+ * Tests that pub/sub survives a lost connection, against a small server
+ * run by the test itself: the subscriber connection is dropped while the
+ * server stops listening and while it keeps listening, and messages must
+ * reach the handlers again once it is back.
+ *
+ * usage: test_subscriber
+ */
+
+#define check(cond) do { \
+	if(!(cond)) { \
+		std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		std::exit(1); \
+	} \
+} while(0)
+
+using YiCppLib::RedisKVStore;
+
+/* waits up to 5s for done() */
+template<typename Done>
+static bool eventually(Done done) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while(!done()) {
+		if(std::chrono::steady_clock::now() > deadline) return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	return true;
+}
+
+static std::string bulk(const std::string& s) {
+	return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+/* just enough of a server for pub/sub: (P)SUBSCRIBE, (P)UNSUBSCRIBE and
+ * PUBLISH, anything else is answered +OK. Runs on a thread of its own; the
+ * test steers it through listening and dropSubscribers */
+class Server {
+	public:
+		std::atomic<bool> listening{true};
+		std::atomic<bool> dropSubscribers{false};
+		int port = 0;
+
+		Server() {
+			open();
+			thread = std::thread([this] { loop(); });
+		}
+
+		~Server() {
+			stopping.store(true);
+			thread.join();
+			for(auto& client : clients) {
+				close(client.fd);
+				redisReaderFree(client.reader);
+			}
+			if(listenFd != -1) close(listenFd);
+		}
+
+		/* connections subscribed to name, a channel or a pattern */
+		size_t subscribers(const std::string& name) {
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t count = 0;
+			for(auto& client : clients) count += client.channels.count(name) + client.patterns.count(name);
+			return count;
+		}
+
+	private:
+		struct Client {
+			int fd;
+			redisReader *reader;
+			std::set<std::string> channels, patterns;
+		};
+
+		std::vector<Client> clients;
+		std::mutex mutex;		// clients, for subscribers()
+		int listenFd = -1;
+		std::atomic<bool> stopping{false};
+		std::thread thread;
+
+		/* the port is picked on the first call and kept */
+		void open() {
+			listenFd = socket(AF_INET, SOCK_STREAM, 0);
+			check(listenFd != -1);
+			int on = 1;
+			setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+			struct sockaddr_in sa = {};
+			sa.sin_family = AF_INET;
+			sa.sin_port = htons(port);
+			sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			check(bind(listenFd, (struct sockaddr*)&sa, sizeof(sa)) == 0);
+			check(listen(listenFd, 16) == 0);
+
+			socklen_t len = sizeof(sa);
+			check(getsockname(listenFd, (struct sockaddr*)&sa, &len) == 0);
+			port = ntohs(sa.sin_port);
+		}
+
+		static void send(int fd, const std::string& data) {
+			for(size_t done=0; done<data.size();) {
+				ssize_t n = write(fd, data.data() + done, data.size() - done);
+				if(n <= 0) return;	// the client is gone, its read will tell
+				done += n;
+			}
+		}
+
+		void loop() {
+			while(!stopping.load()) {
+				if(listening.load() != (listenFd != -1)) {
+					if(listenFd == -1) open();
+					else {
+						close(listenFd);
+						listenFd = -1;
+					}
+				}
+				if(dropSubscribers.exchange(false)) {
+					std::lock_guard<std::mutex> lock(mutex);
+					for(size_t i=clients.size(); i-- > 0;)
+						if(!clients[i].channels.empty() || !clients[i].patterns.empty()) remove(i);
+				}
+
+				std::vector<struct pollfd> fds;
+				size_t served = clients.size();
+				for(auto& client : clients) fds.push_back({client.fd, POLLIN, 0});
+				if(listenFd != -1) fds.push_back({listenFd, POLLIN, 0});
+				if(poll(fds.data(), fds.size(), 10) <= 0) continue;
+
+				if(listenFd != -1 && fds.back().revents != 0) {
+					int fd = accept(listenFd, nullptr, nullptr);
+					if(fd != -1) {
+						std::lock_guard<std::mutex> lock(mutex);
+						clients.push_back(Client{fd, redisReaderCreate(), {}, {}});
+					}
+				}
+				for(size_t i=served; i-- > 0;)
+					if(fds[i].revents != 0) serve(i);
+			}
+		}
+
+		void remove(size_t i) {
+			close(clients[i].fd);
+			redisReaderFree(clients[i].reader);
+			clients.erase(clients.begin() + i);
+		}
+
+		void serve(size_t i) {
+			char buf[4096];
+			ssize_t n = read(clients[i].fd, buf, sizeof(buf));
+			std::lock_guard<std::mutex> lock(mutex);
+			if(n <= 0) {
+				remove(i);
+				return;
+			}
+
+			redisReaderFeed(clients[i].reader, buf, n);
+			void *reply;
+			while(redisReaderGetReply(clients[i].reader, &reply) == REDIS_OK && reply != nullptr) {
+				redisReply *r = static_cast<redisReply*>(reply);
+				std::vector<std::string> argv;
+				for(size_t j=0; j<r->elements; j++) argv.emplace_back(r->element[j]->str, r->element[j]->len);
+				freeReplyObject(r);
+				if(!argv.empty()) command(clients[i], argv);
+			}
+		}
+
+		void command(Client& client, std::vector<std::string>& argv) {
+			std::string name = argv[0];
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			bool pattern = name[0] == 'p';
+			auto& names = pattern ? client.patterns : client.channels;
+
+			if(name == "subscribe" || name == "psubscribe" || name == "unsubscribe" || name == "punsubscribe") {
+				for(size_t j=1; j<argv.size(); j++) {
+					if(name.find("unsub") == std::string::npos) names.insert(argv[j]);
+					else names.erase(argv[j]);
+					send(client.fd, "*3\r\n" + bulk(name) + bulk(argv[j]) + ":" +
+						std::to_string(client.channels.size() + client.patterns.size()) + "\r\n");
+				}
+			}
+			else if(name == "publish" && argv.size() == 3) {
+				long long receivers = 0;
+				for(auto& other : clients) {
+					if(other.channels.count(argv[1])) {
+						send(other.fd, "*3\r\n" + bulk("message") + bulk(argv[1]) + bulk(argv[2]));
+						receivers++;
+					}
+					for(auto& match : other.patterns) {
+						if(fnmatch(match.c_str(), argv[1].c_str(), 0) != 0) continue;
+						send(other.fd, "*4\r\n" + bulk("pmessage") + bulk(match) + bulk(argv[1]) + bulk(argv[2]));
+						receivers++;
+					}
+				}
+				send(client.fd, ":" + std::to_string(receivers) + "\r\n");
+			}
+			else send(client.fd, "+OK\r\n");
+		}
+};
+
+/* what the handlers were given, as pattern:channel:payload */
+class Inbox {
+	public:
+		void add(const RedisKVStore::Message& message) {
+			std::lock_guard<std::mutex> lock(mutex);
+			messages.push_back(message.pattern + ":" + message.channel + ":" + message.payload);
+		}
+
+		bool has(const std::string& message) {
+			std::lock_guard<std::mutex> lock(mutex);
+			return std::find(messages.begin(), messages.end(), message) != messages.end();
+		}
+
+		bool receives(const std::string& message) {
+			return eventually([&] { return has(message); });
+		}
+
+	private:
+		std::mutex mutex;
+		std::vector<std::string> messages;
+};
+
+static bool restored(Server& server) {
+	return eventually([&] { return server.subscribers("news") == 1 && server.subscribers("ev.*") == 1; });
+}
+
+int main() {
+	Server server;
+	Inbox inbox;
+	auto handler = [&](const RedisKVStore::Message& message) { inbox.add(message); };
+
+	RedisKVStore::ConnectionOptions options;
+	options.subscriberReconnectInterval = std::chrono::milliseconds(20);
+	RedisKVStore store("127.0.0.1", server.port, options);
+
+	store.subscribe("news", handler);
+	store.psubscribe("ev.*", handler);
+	store.subscribe("gone", handler);
+	check(store.publish("news", "1") == 1);
+	check(store.publish("ev.a", "1") == 1);
+	check(inbox.receives(":news:1"));
+	check(inbox.receives("ev.*:ev.a:1"));
+
+	/* server down: reconnects fail, subscribing throws, unsubscribing is
+	 * remembered, and what is published meanwhile is lost */
+	server.listening.store(false);
+	server.dropSubscribers.store(true);
+	check(eventually([&] { return server.subscribers("news") == 0; }));
+	check(store.publish("news", "lost") == 0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	bool threw = false;
+	try {
+		store.subscribe("other", handler);
+	}
+	catch(const std::runtime_error&) {
+		threw = true;
+	}
+	check(threw);
+	store.unsubscribe("gone");
+
+	/* back up: the confirmed subscriptions are restored, the rest is not */
+	server.listening.store(true);
+	check(restored(server));
+	check(server.subscribers("gone") == 0 && server.subscribers("other") == 0);
+	check(store.publish("news", "2") == 1);
+	check(store.publish("ev.b", "2") == 1);
+	check(inbox.receives(":news:2"));
+	check(inbox.receives("ev.*:ev.b:2"));
+	check(!inbox.has(":news:lost"));
+
+	/* a connection dropped while the server stays up comes back too */
+	server.dropSubscribers.store(true);
+	check(eventually([&] { return server.subscribers("news") == 0; }));
+	check(restored(server));
+	check(store.publish("news", "3") == 1);
+	check(inbox.receives(":news:3"));
+
+	store.subscribe("other", handler);
+	check(store.publish("other", "4") == 1);
+	check(inbox.receives(":other:4"));
+
+	std::printf("subscriber: ok\n");
+	return 0;
+}